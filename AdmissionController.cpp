@@ -0,0 +1,73 @@
+#include "AdmissionController.h"
+
+#include <algorithm>
+
+AdmissionController::AdmissionController(size_t max_connections,
+        Clock::duration target, Clock::duration interval)
+    : max_connections(max_connections), target(target), interval(interval),
+      interval_start(Clock::now()), min_sojourn(Clock::duration::max()),
+      max_sojourn(Clock::duration::zero()) {}
+
+bool AdmissionController::admit(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (in_flight >= max_connections) {
+            shed_overflow++;
+            return false;
+        }
+        in_flight++;
+        queue.push_back(Connection{fd, Clock::now(), false});
+    }
+    admitted++;
+    not_empty.notify_one();
+    return true;
+}
+
+AdmissionController::Connection AdmissionController::next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this] { return !queue.empty(); });
+
+    Connection connection = queue.front();
+    queue.pop_front();
+    connection.shed = shouldShed(connection, Clock::now());
+    if (connection.shed) {
+        shed_delay++;
+    }
+    return connection;
+}
+
+void AdmissionController::finished(const Connection &connection, bool succeeded) {
+    if (!connection.shed) {
+        if (succeeded) {
+            served++;
+        } else {
+            failed++;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    in_flight--;
+}
+
+AdmissionController::Stats AdmissionController::getStats() const {
+    return Stats{admitted, served, failed, shed_overflow, shed_delay};
+}
+
+// Must be called with mutex held, after connection has been dequeued.
+bool AdmissionController::shouldShed(const Connection &connection, Clock::time_point now) {
+    Clock::duration sojourn = now - connection.accepted_at;
+    bool shed = sojourn > (overloaded ? target : interval);
+    min_sojourn = std::min(min_sojourn, sojourn);
+    max_sojourn = std::max(max_sojourn, sojourn);
+
+    // Overload starts when no connection got through the queue within
+    // target for a whole interval, and ends when every one of them did, so
+    // that the queue has drained. Judging the end by the smallest delay too
+    // would end it at once, since the connections still served wait little.
+    if (now - interval_start >= interval) {
+        overloaded = overloaded ? max_sojourn > target : min_sojourn > target;
+        min_sojourn = Clock::duration::max();
+        max_sojourn = Clock::duration::zero();
+        interval_start = now;
+    }
+    return shed;
+}
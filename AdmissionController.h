@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Bounded queue of accepted connections waiting for a worker thread.
+//
+// Connections beyond max_connections (queued plus being served) are refused
+// at admission. Connections that do get queued are shed with the request
+// queue variant of CoDel: normally a connection is only shed once it has
+// waited a whole `interval`, but once the queueing delay has stayed above
+// `target` for an interval, every connection that has waited longer than
+// `target` is shed until the queue drains, which is taken to be when none has
+// for an interval. The worker is told to answer those with a 503 instead of
+// serving the request.
+//
+// Packet CoDel's drop rate, one drop per interval / sqrt(drops), is far too
+// slow for hundreds of connections a second; this keeps the delay of served
+// connections near `target` under sustained overload.
+class AdmissionController {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Connection {
+        int fd;
+        Clock::time_point accepted_at;
+        bool shed;
+    };
+
+    struct Stats {
+        uint64_t admitted;
+        uint64_t served;
+        uint64_t failed;
+        uint64_t shed_overflow;
+        uint64_t shed_delay;
+    };
+
+ private:
+    const size_t max_connections;
+    const Clock::duration target;
+    const Clock::duration interval;
+
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::deque<Connection> queue;
+    size_t in_flight = 0;
+
+    // CoDel state, guarded by mutex: the range of queueing delays seen in the
+    // current interval, and whether the queue is overloaded
+    Clock::time_point interval_start;
+    Clock::duration min_sojourn;
+    Clock::duration max_sojourn;
+    bool overloaded = false;
+
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> served{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> shed_overflow{0};
+    std::atomic<uint64_t> shed_delay{0};
+
+    bool shouldShed(const Connection &connection, Clock::time_point now);
+
+ public:
+    AdmissionController(size_t max_connections,
+            Clock::duration target = std::chrono::milliseconds(5),
+            Clock::duration interval = std::chrono::milliseconds(100));
+
+    // Queues fd for a worker. Returns false if the connection limit has been
+    // reached, in which case the caller still owns fd and should shed it.
+    bool admit(int fd);
+
+    // Blocks until a connection is available. If the returned connection has
+    // `shed` set, the worker should reject it rather than serve it. Either way
+    // finished() must be called once the worker is done with it, saying
+    // whether a connection it served was served without errors.
+    Connection next();
+    void finished(const Connection &connection, bool succeeded = true);
+
+    Stats getStats() const;
+};
@@ -0,0 +1,123 @@
+#include "Chunked.h"
+#include "HttpWire.h"
+#include "Scan.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+
+static const size_t max_line_size = 8 * 1024;
+static const size_t max_trailer_size = 64 * 1024;
+
+const char *ChunkedDecoder::decode(const char *begin, const char *end, std::string &body) {
+    const char *p = begin;
+    while (p < end && state != State::Done) {
+        if (state == State::Data) {
+            size_t length = std::min<unsigned long long>(remaining, end - p);
+            body.append(p, length);
+            p += length;
+            remaining -= length;
+            if (remaining == 0) {
+                state = State::DataEnd;
+            }
+            continue;
+        }
+
+        // Everything else is a line, which may be split across pieces
+        const char *newline = scan_byte(p, end, '\n');
+        if (line.size() + (newline - p) > max_line_size) {
+            throw std::runtime_error("Chunked body line too long");
+        }
+        line.append(p, newline);
+        if (newline == end) {
+            return end;
+        }
+        p = newline + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        endLine();
+        line.clear();
+    }
+    return p;
+}
+
+void ChunkedDecoder::endLine() {
+    switch (state) {
+        case State::Size: {
+            // Chunk extensions, after a ';', are ignored
+            std::string size = http_trim(line.substr(0, line.find(';')));
+            if (size.empty() || size.size() > 15
+                    || size.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                throw std::runtime_error("Malformed chunk size");
+            }
+            remaining = std::stoull(size, nullptr, 16);
+            state = remaining == 0 ? State::Trailer : State::Data;
+            break;
+        }
+        case State::DataEnd:
+            if (!line.empty()) {
+                throw std::runtime_error("Chunk data longer than its size");
+            }
+            state = State::Size;
+            break;
+        case State::Trailer:
+            if (line.empty()) {
+                state = State::Done;
+                break;
+            }
+            trailer_size += line.size();
+            if (trailer_size > max_trailer_size || line.find(':') == std::string::npos) {
+                throw std::runtime_error("Malformed trailer");
+            }
+            trailers.push_back(HttpHeader::fromString(line));
+            break;
+        default:
+            break;
+    }
+}
+
+std::string chunked_encode(const char *data, size_t size) {
+    if (size == 0) {
+        return "";
+    }
+    char size_line[32];
+    int length = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+    std::string result;
+    result.reserve(length + size + 2);
+    result.append(size_line, length);
+    result.append(data, size);
+    result += "\r\n";
+    return result;
+}
+
+std::string chunked_encode_end(const std::vector<HttpHeader> &trailers) {
+    std::string result = "0\r\n";
+    for (const HttpHeader &trailer : trailers) {
+        result += trailer.toString();
+        result += "\r\n";
+    }
+    result += "\r\n";
+    return result;
+}
+
+bool chunked_is_chunked(const std::string &transfer_encoding) {
+    std::string value = http_trim(transfer_encoding);
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value == "chunked";
+}
+
+bool chunked_trailer_allowed(const HttpHeader &trailer) {
+    static const char *const forbidden[] = {
+        "Transfer-Encoding", "Content-Length", "Trailer", "Connection", "Host",
+        "Content-Encoding", "Content-Type", "Content-Range", "Authorization",
+        "Set-Cookie", "WWW-Authenticate", "Cache-Control", "Expires", "Date",
+    };
+    for (const char *name : forbidden) {
+        if (trailer.hasName(name)) {
+            return false;
+        }
+    }
+    return true;
+}
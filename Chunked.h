@@ -0,0 +1,48 @@
+#pragma once
+
+#include "HttpHeader.h"
+
+#include <string>
+#include <vector>
+
+// The chunked transfer coding (RFC 7230 section 4.1), which frames a body of
+// unknown length as a series of length-prefixed chunks, ended by an empty
+// chunk and optional trailer fields.
+
+// Incremental decoder. Input can be fed in pieces of any size; apart from the
+// decoded data, only the current chunk-size or trailer line is buffered.
+class ChunkedDecoder {
+ private:
+    enum class State { Size, Data, DataEnd, Trailer, Done };
+
+    State state = State::Size;
+    unsigned long long remaining = 0;
+    std::string line;
+    size_t trailer_size = 0;
+    std::vector<HttpHeader> trailers;
+
+    void endLine();
+
+ public:
+    // Decodes as much of [begin, end) as it can, appending chunk data to body.
+    // Returns a pointer past the last byte consumed, which is end unless the
+    // body ended first. Throws std::runtime_error on malformed input.
+    const char *decode(const char *begin, const char *end, std::string &body);
+
+    bool done() const { return state == State::Done; }
+    const std::vector<HttpHeader> &getTrailers() const { return trailers; }
+};
+
+// Frames size bytes of data as one chunk. Empty data would end the body, so
+// it gives an empty string instead.
+std::string chunked_encode(const char *data, size_t size);
+
+// The last chunk and trailers, which end a chunked body
+std::string chunked_encode_end(const std::vector<HttpHeader> &trailers = std::vector<HttpHeader>());
+
+// Whether transfer_encoding, a Transfer-Encoding value, is exactly "chunked"
+bool chunked_is_chunked(const std::string &transfer_encoding);
+
+// Whether a trailer field may be treated like a header field. Fields that
+// frame, route or describe the message (RFC 7230 section 4.1.2) may not.
+bool chunked_trailer_allowed(const HttpHeader &trailer);
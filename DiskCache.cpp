@@ -0,0 +1,205 @@
+#include "DiskCache.h"
+#include "HttpHeader.h"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+// FNV-1a, so that file names stay stable between runs and builds
+static std::string hash_url(const std::string &url) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : url) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
+
+DiskCache::DiskCache(const std::string &directory) : directory(directory) {
+    if (this->directory.empty() || this->directory.back() != '/') {
+        this->directory += "/";
+    }
+    if (mkdir(this->directory.c_str(), 0755) == -1 && errno != EEXIST) {
+        throw std::runtime_error("Could not create cache directory " + directory);
+    }
+}
+
+std::string DiskCache::pathFor(const std::string &url, const std::string &extension) const {
+    return directory + hash_url(url) + extension;
+}
+
+bool DiskCache::lookup(const std::string &url, Entry &entry) const {
+    std::ifstream metadata(pathFor(url, ".meta"));
+    if (!metadata.is_open()) {
+        return false;
+    }
+
+    Entry result;
+    result.body_path = pathFor(url, ".body");
+    std::string line;
+    std::string cached_url;
+    while (std::getline(metadata, line)) {
+        HttpHeader header = HttpHeader::fromString(line);
+        if (header.name == "URL") {
+            cached_url = header.value;
+        } else if (header.name == "ETag") {
+            result.etag = header.value;
+        } else if (header.name == "Last-Modified") {
+            result.last_modified = header.value;
+        } else if (header.name == "Content-Length") {
+            try {
+                result.content_length = std::stoll(header.value);
+            } catch (const std::logic_error&) {
+                return false;
+            }
+        }
+    }
+
+    // Guard against hash collisions and bodies that have been tampered with
+    struct stat s;
+    if (cached_url != url || stat(result.body_path.c_str(), &s) == -1
+            || s.st_size != result.content_length) {
+        return false;
+    }
+    entry = result;
+    return true;
+}
+
+bool DiskCache::writeMetadata(const std::string &url, const Entry &entry) const {
+    std::string path = pathFor(url, ".meta");
+    std::string temp_path = path + ".tmp";
+    std::ofstream metadata(temp_path, std::ios::out | std::ios::trunc);
+    metadata << HttpHeader("URL", url).toString() << "\n";
+    if (!entry.etag.empty()) {
+        metadata << HttpHeader("ETag", entry.etag).toString() << "\n";
+    }
+    if (!entry.last_modified.empty()) {
+        metadata << HttpHeader("Last-Modified", entry.last_modified).toString() << "\n";
+    }
+    metadata << HttpHeader("Content-Length", std::to_string(entry.content_length)).toString()
+             << "\n";
+    metadata.close();
+    if (!metadata.good()) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool DiskCache::store(const std::string &url, const HttpResponse &response,
+                      const std::string &body_file, Entry &entry) const {
+    if (!response.hasHeader("ETag") && !response.hasHeader("Last-Modified")) {
+        return false;
+    }
+
+    Entry result;
+    result.etag = response.getHeader("ETag");
+    result.last_modified = response.getHeader("Last-Modified");
+    result.body_path = pathFor(url, ".body");
+    struct stat s;
+    if (stat(body_file.c_str(), &s) == -1) {
+        return false;
+    }
+    result.content_length = s.st_size;
+
+    // Copy to a new file and rename it into place, so a reader of the old
+    // body never sees a partial one. Cached bodies are read-only, as a
+    // reminder that they are only ever replaced.
+    std::string temp_path = result.body_path + ".tmp";
+    if (!materialize(body_file, temp_path) || chmod(temp_path.c_str(), 0444) != 0
+            || std::rename(temp_path.c_str(), result.body_path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    if (!writeMetadata(url, result)) {
+        return false;
+    }
+    entry = result;
+    return true;
+}
+
+void DiskCache::refresh(const std::string &url, const HttpResponse &response, Entry &entry) const {
+    bool changed = false;
+    if (response.hasHeader("ETag") && response.getHeader("ETag") != entry.etag) {
+        entry.etag = response.getHeader("ETag");
+        changed = true;
+    }
+    if (response.hasHeader("Last-Modified")
+            && response.getHeader("Last-Modified") != entry.last_modified) {
+        entry.last_modified = response.getHeader("Last-Modified");
+        changed = true;
+    }
+    if (changed) {
+        writeMetadata(url, entry);
+    }
+}
+
+bool DiskCache::materialize(const std::string &source, const std::string &destination) {
+    // Replace rather than overwrite destination, in case it is read-only or
+    // still linked to the cache by an older version
+    unlink(destination.c_str());
+
+    int in = open(source.c_str(), O_RDONLY);
+    if (in == -1) {
+        return false;
+    }
+    int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out == -1) {
+        close(in);
+        return false;
+    }
+
+    bool ok = true;
+    ssize_t bytes_read = 0;
+#ifdef FICLONE
+    // A reflink shares the blocks but stays independent of the cache copy
+    if (ioctl(out, FICLONE, in) != 0)
+#endif
+    {
+        char buffer[65536];
+        while ((bytes_read = read(in, buffer, sizeof(buffer))) > 0) {
+            if (write(out, buffer, bytes_read) != bytes_read) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    // Matching modification times let isCopyOf() recognise the copy later
+    struct stat s;
+    if (ok && bytes_read == 0 && fstat(in, &s) == 0) {
+        timespec times[2] = {s.st_atim, s.st_mtim};
+        futimens(out, times);
+    }
+    close(in);
+    close(out);
+    if (!ok || bytes_read != 0) {
+        unlink(destination.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool DiskCache::isCopyOf(const Entry &entry, const std::string &path) {
+    // Every stored body is a new file, so its modification time identifies
+    // the body, and with it the validators it was stored under. Editing the
+    // copy changes its modification time.
+    struct stat body;
+    struct stat copy;
+    return stat(entry.body_path.c_str(), &body) == 0 && stat(path.c_str(), &copy) == 0
+        && S_ISREG(copy.st_mode) && copy.st_ino != body.st_ino
+        && copy.st_size == entry.content_length && copy.st_size == body.st_size
+        && copy.st_mtim.tv_sec == body.st_mtim.tv_sec
+        && copy.st_mtim.tv_nsec == body.st_mtim.tv_nsec;
+}
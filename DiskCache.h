@@ -0,0 +1,50 @@
+#pragma once
+
+#include "HttpResponse.h"
+
+#include <string>
+
+// Client-side cache of response bodies and the metadata needed to revalidate
+// them. Each URL gets a body file and a metadata file of "Name: value" lines
+// in the cache directory.
+class DiskCache {
+ public:
+    struct Entry {
+        std::string etag;
+        std::string last_modified;
+        long long content_length = -1;
+        std::string body_path;
+    };
+
+ private:
+    std::string directory;
+
+    std::string pathFor(const std::string &url, const std::string &extension) const;
+    bool writeMetadata(const std::string &url, const Entry &entry) const;
+
+ public:
+    // Creates directory if it does not exist yet. Throws std::runtime_error if
+    // that is not possible.
+    DiskCache(const std::string &directory);
+
+    // Finds a complete cache entry for url
+    bool lookup(const std::string &url, Entry &entry) const;
+
+    // Caches body_file as the body of a 200 response, if the response has
+    // validators worth keeping. On success entry describes the new cache entry.
+    bool store(const std::string &url, const HttpResponse &response,
+               const std::string &body_file, Entry &entry) const;
+
+    // Updates the validators of an entry from a 304 response
+    void refresh(const std::string &url, const HttpResponse &response, Entry &entry) const;
+
+    // Makes destination an independent copy of source, by reflink when the
+    // filesystem allows it and by copying otherwise. Hardlinks are not used,
+    // since writing to the destination would then change the cached body.
+    // The copy gets the modification time of source.
+    static bool materialize(const std::string &source, const std::string &destination);
+
+    // Whether path is an unmodified copy of entry's body, so it need not be
+    // materialized again
+    static bool isCopyOf(const Entry &entry, const std::string &path);
+};
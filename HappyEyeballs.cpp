@@ -0,0 +1,89 @@
+#include "HappyEyeballs.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+int connect_happy_eyeballs(const std::vector<Address> &addresses,
+        std::chrono::milliseconds attempt_delay, std::chrono::milliseconds timeout) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline = Clock::now() + timeout;
+
+    std::vector<pollfd> attempts;
+    size_t next_address = 0;
+    Clock::time_point next_attempt = Clock::now();
+    int connected = -1;
+
+    while (connected == -1 && Clock::now() < deadline) {
+        // Start the next attempt if it is due, or nothing else is in progress
+        if (next_address < addresses.size()
+                && (Clock::now() >= next_attempt || attempts.empty())) {
+            const Address &address = addresses[next_address++];
+            next_attempt = Clock::now() + attempt_delay;
+
+            // Attempts that fail at once, like those that fail later, let the
+            // next one start without waiting
+            int sock = socket(address.family(), SOCK_STREAM, 0);
+            if (sock == -1) {
+                next_attempt = Clock::now();
+                continue;
+            }
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+            if (connect(sock, address.get(), address.length) == 0) {
+                connected = sock;
+                break;
+            } else if (errno != EINPROGRESS) {
+                close(sock);
+                next_attempt = Clock::now();
+                continue;
+            }
+            attempts.push_back(pollfd{sock, POLLOUT, 0});
+        }
+        if (attempts.empty()) {
+            if (next_address >= addresses.size()) {
+                break; // Everything failed
+            }
+            continue;
+        }
+
+        // Wait until an attempt completes or it is time for the next one
+        Clock::time_point wake = deadline;
+        if (next_address < addresses.size() && next_attempt < wake) {
+            wake = next_attempt;
+        }
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(wake - Clock::now());
+        if (poll(attempts.data(), attempts.size(), std::max<long>(wait.count(), 0)) < 0
+                && errno != EINTR) {
+            break;
+        }
+
+        for (auto it = attempts.begin(); it != attempts.end();) {
+            if (it->revents == 0) {
+                it++;
+                continue;
+            }
+            int error = 0;
+            socklen_t error_size = sizeof(error);
+            getsockopt(it->fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+            if (error == 0 && connected == -1) {
+                connected = it->fd;
+            } else {
+                close(it->fd);
+                // A failure means the next attempt need not wait any longer
+                next_attempt = Clock::now();
+            }
+            it = attempts.erase(it);
+        }
+    }
+
+    for (const pollfd &attempt : attempts) {
+        close(attempt.fd);
+    }
+    if (connected != -1) {
+        fcntl(connected, F_SETFL, fcntl(connected, F_GETFL) & ~O_NONBLOCK);
+    }
+    return connected;
+}
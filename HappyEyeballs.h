@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Resolver.h"
+
+#include <chrono>
+#include <vector>
+
+// Connects to the first of `addresses` to accept a TCP connection, racing
+// attempts RFC 8305 style: a new attempt is started every `attempt_delay`, or
+// as soon as the previous one fails, and the first to complete wins.
+//
+// Returns a connected, blocking socket, or -1 if every attempt failed or
+// `timeout` elapsed.
+int connect_happy_eyeballs(const std::vector<Address> &addresses,
+        std::chrono::milliseconds attempt_delay = std::chrono::milliseconds(250),
+        std::chrono::milliseconds timeout = std::chrono::seconds(10));
@@ -0,0 +1,438 @@
+#include "Hpack.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+struct HpackStaticEntry {
+    const char *name;
+    const char *value;
+};
+
+struct HpackHuffmanCode {
+    uint32_t code;
+    uint8_t length;
+};
+
+// RFC 7541 Appendix A
+const HpackStaticEntry hpack_static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 Appendix B, indexed by symbol, with EOS last
+const HpackHuffmanCode hpack_huffman_codes[] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+const size_t static_table_count = sizeof(hpack_static_table) / sizeof(hpack_static_table[0]);
+const int huffman_eos = 256;
+
+// Binary trie over the Huffman codes, for decoding a bit at a time
+struct HuffmanNode {
+    int children[2];
+    int symbol;
+};
+
+const std::vector<HuffmanNode> &huffman_trie() {
+    static const std::vector<HuffmanNode> trie = [] {
+        std::vector<HuffmanNode> nodes(1, HuffmanNode{{-1, -1}, -1});
+        for (int symbol = 0; symbol <= huffman_eos; symbol++) {
+            const HpackHuffmanCode &code = hpack_huffman_codes[symbol];
+            int node = 0;
+            for (int bit = code.length - 1; bit >= 0; bit--) {
+                int b = (code.code >> bit) & 1;
+                if (nodes[node].children[b] == -1) {
+                    nodes[node].children[b] = nodes.size();
+                    nodes.push_back(HuffmanNode{{-1, -1}, -1});
+                }
+                node = nodes[node].children[b];
+            }
+            nodes[node].symbol = symbol;
+        }
+        return nodes;
+    }();
+    return trie;
+}
+
+size_t entry_size(const HttpHeader &header) {
+    return header.name.size() + header.value.size() + 32;
+}
+
+void encode_integer(std::string &out, uint8_t flags, int prefix_bits, uint64_t value) {
+    const uint64_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out.push_back(static_cast<char>(flags | max_prefix));
+    value -= max_prefix;
+    while (value >= 128) {
+        out.push_back(static_cast<char>(value % 128 + 128));
+        value /= 128;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint64_t decode_integer(const std::string &in, size_t &pos, int prefix_bits) {
+    if (pos >= in.size()) {
+        throw std::runtime_error("Truncated HPACK integer");
+    }
+    const uint64_t max_prefix = (1u << prefix_bits) - 1;
+    uint64_t value = static_cast<uint8_t>(in[pos++]) & max_prefix;
+    if (value < max_prefix) {
+        return value;
+    }
+    for (int shift = 0; ; shift += 7) {
+        if (pos >= in.size() || shift > 56) {
+            throw std::runtime_error("Malformed HPACK integer");
+        }
+        uint8_t b = in[pos++];
+        value += static_cast<uint64_t>(b & 127) << shift;
+        if (!(b & 128)) {
+            return value;
+        }
+    }
+}
+
+void encode_string(std::string &out, const std::string &s) {
+    size_t huffman_bits = 0;
+    for (char c : s) {
+        huffman_bits += hpack_huffman_codes[static_cast<uint8_t>(c)].length;
+    }
+    size_t huffman_length = (huffman_bits + 7) / 8;
+    if (huffman_length >= s.size()) {
+        encode_integer(out, 0x00, 7, s.size());
+        out += s;
+        return;
+    }
+
+    encode_integer(out, 0x80, 7, huffman_length);
+    uint64_t bits = 0;
+    int bit_count = 0;
+    for (char c : s) {
+        const HpackHuffmanCode &code = hpack_huffman_codes[static_cast<uint8_t>(c)];
+        bits = (bits << code.length) | code.code;
+        bit_count += code.length;
+        while (bit_count >= 8) {
+            bit_count -= 8;
+            out.push_back(static_cast<char>(bits >> bit_count));
+        }
+        bits &= (1ull << bit_count) - 1;
+    }
+    if (bit_count > 0) {
+        // Pad with the most significant bits of EOS, which are all ones
+        out.push_back(static_cast<char>((bits << (8 - bit_count)) | ((1 << (8 - bit_count)) - 1)));
+    }
+}
+
+std::string decode_huffman(const std::string &in, size_t pos, size_t length) {
+    const std::vector<HuffmanNode> &trie = huffman_trie();
+    std::string result;
+    int node = 0;
+    int bits_since_symbol = 0;
+    bool all_ones = true;
+    for (size_t i = pos; i < pos + length; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            int b = (static_cast<uint8_t>(in[i]) >> bit) & 1;
+            node = trie[node].children[b];
+            if (node == -1) {
+                throw std::runtime_error("Invalid Huffman code");
+            }
+            bits_since_symbol++;
+            all_ones = all_ones && b;
+            if (trie[node].symbol != -1) {
+                if (trie[node].symbol == huffman_eos) {
+                    throw std::runtime_error("EOS in Huffman string");
+                }
+                result.push_back(static_cast<char>(trie[node].symbol));
+                node = 0;
+                bits_since_symbol = 0;
+                all_ones = true;
+            }
+        }
+    }
+    if (bits_since_symbol > 7 || !all_ones) {
+        throw std::runtime_error("Invalid Huffman padding");
+    }
+    return result;
+}
+
+std::string decode_string(const std::string &in, size_t &pos) {
+    if (pos >= in.size()) {
+        throw std::runtime_error("Truncated HPACK string");
+    }
+    bool huffman = in[pos] & 0x80;
+    uint64_t length = decode_integer(in, pos, 7);
+    if (length > in.size() - pos) {
+        throw std::runtime_error("Truncated HPACK string");
+    }
+    std::string result = huffman ? decode_huffman(in, pos, length) : in.substr(pos, length);
+    pos += length;
+    return result;
+}
+
+// Headers whose values should never be put in a compression table
+bool is_sensitive(const HttpHeader &header) {
+    return header.name == "authorization" || header.name == "cookie"
+        || header.name == "set-cookie";
+}
+
+}  // namespace
+
+void HpackDynamicTable::evict(size_t required) {
+    while (!entries.empty() && size + required > max_size) {
+        size -= entry_size(entries.back());
+        entries.pop_back();
+    }
+}
+
+void HpackDynamicTable::add(const HttpHeader &header) {
+    size_t required = entry_size(header);
+    if (required > max_size) {
+        // Adding an entry larger than the table empties it (RFC 7541 4.4)
+        entries.clear();
+        size = 0;
+        return;
+    }
+    evict(required);
+    entries.push_front(header);
+    size += required;
+}
+
+void HpackDynamicTable::setMaxSize(size_t max_size) {
+    this->max_size = max_size;
+    evict(0);
+}
+
+const HttpHeader &HpackDecoder::lookup(uint64_t index) const {
+    static const std::vector<HttpHeader> static_headers = [] {
+        std::vector<HttpHeader> headers;
+        for (const HpackStaticEntry &entry : hpack_static_table) {
+            headers.push_back(HttpHeader(entry.name, entry.value));
+        }
+        return headers;
+    }();
+
+    if (index == 0) {
+        throw std::runtime_error("Invalid HPACK index 0");
+    } else if (index <= static_table_count) {
+        return static_headers[index - 1];
+    } else if (index - static_table_count - 1 < table.count()) {
+        return table.get(index - static_table_count - 1);
+    }
+    throw std::runtime_error("HPACK index out of range");
+}
+
+std::vector<HttpHeader> HpackDecoder::decode(const std::string &block) {
+    std::vector<HttpHeader> headers;
+    size_t pos = 0;
+    while (pos < block.size()) {
+        uint8_t b = block[pos];
+        if (b & 0x80) { // Indexed header field
+            headers.push_back(lookup(decode_integer(block, pos, 7)));
+        } else if ((b & 0xe0) == 0x20) { // Dynamic table size update
+            uint64_t max_size = decode_integer(block, pos, 5);
+            if (max_size > max_table_size) {
+                throw std::runtime_error("HPACK table size update over the limit");
+            }
+            table.setMaxSize(max_size);
+        } else { // Literal header field, with or without indexing
+            bool indexing = b & 0x40;
+            uint64_t name_index = decode_integer(block, pos, indexing ? 6 : 4);
+            HttpHeader header;
+            header.name = name_index != 0 ? lookup(name_index).name : decode_string(block, pos);
+            header.value = decode_string(block, pos);
+            if (indexing) {
+                table.add(header);
+            }
+            headers.push_back(header);
+        }
+    }
+    return headers;
+}
+
+void HpackEncoder::setMaxTableSize(size_t max_size) {
+    // Never use more than the default, whatever the peer allows
+    max_size = std::min<size_t>(max_size, 4096);
+    if (max_size != table.getMaxSize()) {
+        table.setMaxSize(max_size);
+        table_size_changed = true;
+    }
+}
+
+std::string HpackEncoder::encode(const std::vector<HttpHeader> &headers) {
+    std::string out;
+    if (table_size_changed) {
+        encode_integer(out, 0x20, 5, table.getMaxSize());
+        table_size_changed = false;
+    }
+
+    for (const HttpHeader &header : headers) {
+        uint64_t exact_index = 0;
+        uint64_t name_index = 0;
+        for (size_t i = 0; i < static_table_count && exact_index == 0; i++) {
+            if (header.name == hpack_static_table[i].name) {
+                if (name_index == 0) {
+                    name_index = i + 1;
+                }
+                if (header.value == hpack_static_table[i].value) {
+                    exact_index = i + 1;
+                }
+            }
+        }
+        for (size_t i = 0; i < table.count() && exact_index == 0; i++) {
+            const HttpHeader &entry = table.get(i);
+            if (header.name == entry.name) {
+                if (name_index == 0) {
+                    name_index = static_table_count + 1 + i;
+                }
+                if (header.value == entry.value) {
+                    exact_index = static_table_count + 1 + i;
+                }
+            }
+        }
+
+        if (exact_index != 0 && !is_sensitive(header)) {
+            encode_integer(out, 0x80, 7, exact_index);
+            continue;
+        }
+        if (is_sensitive(header)) { // Literal never indexed
+            encode_integer(out, 0x10, 4, name_index);
+        } else { // Literal with incremental indexing
+            encode_integer(out, 0x40, 6, name_index);
+        }
+        if (name_index == 0) {
+            encode_string(out, header.name);
+        }
+        encode_string(out, header.value);
+        if (!is_sensitive(header)) {
+            table.add(header);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "HttpHeader.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// HPACK header compression for HTTP/2 (RFC 7541).
+
+// The dynamic table shared by an encoder or decoder and its peer.
+class HpackDynamicTable {
+ private:
+    std::deque<HttpHeader> entries; // Newest first
+    size_t size = 0;
+    size_t max_size = 4096;
+
+    void evict(size_t required);
+
+ public:
+    void add(const HttpHeader &header);
+    void setMaxSize(size_t max_size);
+    size_t getMaxSize() const { return this->max_size; }
+
+    size_t count() const { return this->entries.size(); }
+    // index is 0-based, newest first
+    const HttpHeader &get(size_t index) const { return this->entries[index]; }
+};
+
+class HpackDecoder {
+ private:
+    HpackDynamicTable table;
+    size_t max_table_size;
+
+    const HttpHeader &lookup(uint64_t index) const;
+
+ public:
+    // max_table_size is the SETTINGS_HEADER_TABLE_SIZE we advertise
+    HpackDecoder(size_t max_table_size = 4096) : max_table_size(max_table_size) {
+        table.setMaxSize(max_table_size);
+    }
+
+    // Throws std::runtime_error on a malformed block, which is a connection
+    // error of type COMPRESSION_ERROR.
+    std::vector<HttpHeader> decode(const std::string &block);
+};
+
+class HpackEncoder {
+ private:
+    HpackDynamicTable table;
+    bool table_size_changed = false;
+
+ public:
+    // Applies the peer's SETTINGS_HEADER_TABLE_SIZE
+    void setMaxTableSize(size_t max_size);
+
+    std::string encode(const std::vector<HttpHeader> &headers);
+};
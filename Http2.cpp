@@ -0,0 +1,256 @@
+#include "Http2.h"
+
+#include <algorithm>
+#include <cctype>
+
+std::string http2_encode_uint32(uint32_t value) {
+    std::string result(4, '\0');
+    result[0] = static_cast<char>(value >> 24);
+    result[1] = static_cast<char>(value >> 16);
+    result[2] = static_cast<char>(value >> 8);
+    result[3] = static_cast<char>(value);
+    return result;
+}
+
+uint32_t http2_parse_uint32(const std::string &payload, size_t offset) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(payload[offset])) << 24
+        | static_cast<uint32_t>(static_cast<uint8_t>(payload[offset + 1])) << 16
+        | static_cast<uint32_t>(static_cast<uint8_t>(payload[offset + 2])) << 8
+        | static_cast<uint32_t>(static_cast<uint8_t>(payload[offset + 3]));
+}
+
+std::string http2_encode_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+        const std::string &payload) {
+    std::string frame;
+    frame.reserve(9 + payload.size());
+    frame.push_back(static_cast<char>(payload.size() >> 16));
+    frame.push_back(static_cast<char>(payload.size() >> 8));
+    frame.push_back(static_cast<char>(payload.size()));
+    frame.push_back(static_cast<char>(type));
+    frame.push_back(static_cast<char>(flags));
+    frame += http2_encode_uint32(stream_id & 0x7fffffff);
+    frame += payload;
+    return frame;
+}
+
+bool http2_parse_frame(const std::string &buffer, size_t &offset, uint32_t max_frame_size,
+        Http2Frame &frame) {
+    if (buffer.size() - offset < 9) {
+        return false;
+    }
+    const char *header = buffer.data() + offset;
+    uint32_t length = static_cast<uint32_t>(static_cast<uint8_t>(header[0])) << 16
+        | static_cast<uint32_t>(static_cast<uint8_t>(header[1])) << 8
+        | static_cast<uint32_t>(static_cast<uint8_t>(header[2]));
+    if (length > max_frame_size) {
+        throw Http2ConnectionError(Http2Error::FRAME_SIZE_ERROR, "Frame too large");
+    }
+    if (buffer.size() - offset < 9 + length) {
+        return false;
+    }
+    frame.type = static_cast<Http2FrameType>(header[3]);
+    frame.flags = header[4];
+    frame.stream_id = http2_parse_uint32(buffer, offset + 5) & 0x7fffffff;
+    frame.payload = buffer.substr(offset + 9, length);
+    offset += 9 + length;
+    return true;
+}
+
+void http2_strip_padding(Http2Frame &frame) {
+    size_t begin = 0;
+    size_t padding = 0;
+    if (frame.hasFlag(Http2Flags::PADDED)) {
+        if (frame.payload.empty()) {
+            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Missing pad length");
+        }
+        padding = static_cast<uint8_t>(frame.payload[0]);
+        begin = 1;
+    }
+    if (frame.type == Http2FrameType::HEADERS && frame.hasFlag(Http2Flags::PRIORITY)) {
+        begin += 5; // Stream dependency and weight, which we ignore
+    }
+    if (begin + padding > frame.payload.size()) {
+        throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Padding exceeds frame");
+    }
+    frame.payload = frame.payload.substr(begin, frame.payload.size() - begin - padding);
+    frame.flags &= ~(Http2Flags::PADDED | Http2Flags::PRIORITY);
+}
+
+std::string http2_encode_settings(const std::vector<std::pair<Http2Setting, uint32_t>> &settings) {
+    std::string payload;
+    for (const auto &setting : settings) {
+        payload.push_back(static_cast<char>(static_cast<uint16_t>(setting.first) >> 8));
+        payload.push_back(static_cast<char>(static_cast<uint16_t>(setting.first)));
+        payload += http2_encode_uint32(setting.second);
+    }
+    return payload;
+}
+
+std::vector<std::pair<Http2Setting, uint32_t>> http2_parse_settings(const std::string &payload) {
+    if (payload.size() % 6 != 0) {
+        throw Http2ConnectionError(Http2Error::FRAME_SIZE_ERROR, "Malformed SETTINGS frame");
+    }
+    std::vector<std::pair<Http2Setting, uint32_t>> settings;
+    for (size_t i = 0; i < payload.size(); i += 6) {
+        uint16_t id = static_cast<uint16_t>(static_cast<uint8_t>(payload[i])) << 8
+            | static_cast<uint8_t>(payload[i + 1]);
+        uint32_t value = http2_parse_uint32(payload, i + 2);
+        if (id == static_cast<uint16_t>(Http2Setting::INITIAL_WINDOW_SIZE)
+                && value > http2_max_window_size) {
+            throw Http2ConnectionError(Http2Error::FLOW_CONTROL_ERROR, "Window size too large");
+        }
+        if (id == static_cast<uint16_t>(Http2Setting::MAX_FRAME_SIZE)
+                && (value < http2_default_max_frame_size || value > 0xffffff)) {
+            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Invalid frame size");
+        }
+        settings.push_back(std::make_pair(static_cast<Http2Setting>(id), value));
+    }
+    return settings;
+}
+
+std::string http2_encode_headers(uint32_t stream_id, const std::string &block, bool end_stream,
+        uint32_t max_frame_size) {
+    std::string frames;
+    size_t offset = 0;
+    do {
+        size_t length = std::min<size_t>(max_frame_size, block.size() - offset);
+        bool last = offset + length == block.size();
+        uint8_t flags = last ? Http2Flags::END_HEADERS : 0;
+        if (offset == 0) {
+            if (end_stream) {
+                flags |= Http2Flags::END_STREAM;
+            }
+            frames += http2_encode_frame(Http2FrameType::HEADERS, flags, stream_id,
+                                         block.substr(offset, length));
+        } else {
+            frames += http2_encode_frame(Http2FrameType::CONTINUATION, flags, stream_id,
+                                         block.substr(offset, length));
+        }
+        offset += length;
+    } while (offset < block.size());
+    return frames;
+}
+
+static std::string to_lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [] (char c) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    });
+    return s;
+}
+
+// Headers which only make sense for a single HTTP/1 connection (RFC 7540 8.1.2.2)
+static bool is_connection_specific(const HttpHeader &header) {
+    return header.hasName("Connection") || header.hasName("Keep-Alive")
+        || header.hasName("Proxy-Connection") || header.hasName("Transfer-Encoding")
+        || header.hasName("Upgrade") || header.hasName("HTTP2-Settings");
+}
+
+std::vector<HttpHeader> http2_request_headers(const HttpRequest &request) {
+    std::vector<HttpHeader> headers;
+    headers.push_back(HttpHeader(":method", http_method_name(request.getMethod())));
+    headers.push_back(HttpHeader(":scheme", "http"));
+    headers.push_back(HttpHeader(":authority", request.getHost()));
+    headers.push_back(HttpHeader(":path", request.getPath()));
+    for (const HttpHeader &header : request.getHeaders()) {
+        if (!header.hasName("Host") && !is_connection_specific(header)) {
+            headers.push_back(HttpHeader(to_lower(header.name), header.value));
+        }
+    }
+    return headers;
+}
+
+HttpRequest http2_request_from_headers(const std::vector<HttpHeader> &headers) {
+    std::string method;
+    std::string path;
+    std::string authority;
+    std::vector<HttpHeader> regular_headers;
+    for (const HttpHeader &header : headers) {
+        if (header.name == ":method") {
+            method = header.value;
+        } else if (header.name == ":path") {
+            path = header.value;
+        } else if (header.name == ":authority") {
+            authority = header.value;
+        } else if (header.name == "host") {
+            if (authority.empty()) {
+                authority = header.value;
+            }
+        } else if (!header.name.empty() && header.name[0] != ':') {
+            regular_headers.push_back(header);
+        }
+    }
+    if (method.empty() || path.empty()) {
+        throw std::runtime_error("Malformed request");
+    }
+
+    HttpRequest request(http_method_from_name(method), path, "HTTP/2.0", authority);
+    for (const HttpHeader &header : regular_headers) {
+        request.addHeader(header);
+    }
+    return request;
+}
+
+std::vector<HttpHeader> http2_response_headers(const HttpResponse &response) {
+    std::vector<HttpHeader> headers;
+    headers.push_back(HttpHeader(":status",
+                                 std::to_string(http_status_code(response.getStatusCode()))));
+    for (const HttpHeader &header : response.getHeaders()) {
+        if (!is_connection_specific(header)) {
+            headers.push_back(HttpHeader(to_lower(header.name), header.value));
+        }
+    }
+    return headers;
+}
+
+HttpResponse http2_response_from_headers(const std::vector<HttpHeader> &headers) {
+    HttpResponse response(HttpStatus::InternalServerError, "HTTP/2.0");
+    bool has_status = false;
+    for (const HttpHeader &header : headers) {
+        if (header.name == ":status") {
+            try {
+                response.setStatusCode(http_status_from_code(std::stoi(header.value)));
+                has_status = true;
+            } catch (const std::logic_error&) {
+                throw std::runtime_error("Malformed response");
+            }
+        } else if (!header.name.empty() && header.name[0] != ':') {
+            response.addHeader(header);
+        }
+    }
+    if (!has_status) {
+        throw std::runtime_error("Malformed response");
+    }
+    return response;
+}
+
+std::string http2_decode_settings_header(const std::string &value) {
+    std::string result;
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (char c : value) {
+        int digit;
+        if (c >= 'A' && c <= 'Z') {
+            digit = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            digit = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            digit = c - '0' + 52;
+        } else if (c == '-' || c == '+') {
+            digit = 62;
+        } else if (c == '_' || c == '/') {
+            digit = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            throw std::runtime_error("Malformed HTTP2-Settings header");
+        }
+        bits = (bits << 6) | digit;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            result.push_back(static_cast<char>(bits >> bit_count));
+            bits &= (1u << bit_count) - 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "HttpHeader.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// HTTP/2 framing (RFC 7540) shared by the h2c server and client.
+
+// Sent by clients before anything else
+const std::string http2_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+const uint32_t http2_default_window_size = 65535;
+const uint32_t http2_default_max_frame_size = 16384;
+const uint32_t http2_max_window_size = 0x7fffffff;
+
+enum class Http2FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+};
+
+namespace Http2Flags {
+const uint8_t END_STREAM = 0x1;
+const uint8_t ACK = 0x1;
+const uint8_t END_HEADERS = 0x4;
+const uint8_t PADDED = 0x8;
+const uint8_t PRIORITY = 0x20;
+}
+
+enum class Http2Error : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    COMPRESSION_ERROR = 0x9,
+};
+
+enum class Http2Setting : uint16_t {
+    HEADER_TABLE_SIZE = 0x1,
+    ENABLE_PUSH = 0x2,
+    MAX_CONCURRENT_STREAMS = 0x3,
+    INITIAL_WINDOW_SIZE = 0x4,
+    MAX_FRAME_SIZE = 0x5,
+    MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+// A connection error; the connection is closed with a GOAWAY carrying code
+class Http2ConnectionError : public std::runtime_error {
+ public:
+    Http2Error code;
+
+    Http2ConnectionError(Http2Error code, const std::string &what)
+        : std::runtime_error(what), code(code) {}
+};
+
+struct Http2Frame {
+    Http2FrameType type;
+    uint8_t flags;
+    uint32_t stream_id;
+    std::string payload;
+
+    bool hasFlag(uint8_t flag) const { return (this->flags & flag) != 0; }
+};
+
+std::string http2_encode_frame(Http2FrameType type, uint8_t flags, uint32_t stream_id,
+        const std::string &payload);
+
+// Parses the frame starting at offset in buffer, advancing offset past it.
+// Returns false if the frame has not been completely received yet. Throws
+// Http2ConnectionError if it is larger than max_frame_size.
+bool http2_parse_frame(const std::string &buffer, size_t &offset, uint32_t max_frame_size,
+        Http2Frame &frame);
+
+// Removes padding, and the priority fields of HEADERS frames, from payload
+void http2_strip_padding(Http2Frame &frame);
+
+std::string http2_encode_settings(const std::vector<std::pair<Http2Setting, uint32_t>> &settings);
+std::vector<std::pair<Http2Setting, uint32_t>> http2_parse_settings(const std::string &payload);
+
+std::string http2_encode_uint32(uint32_t value);
+uint32_t http2_parse_uint32(const std::string &payload, size_t offset);
+
+// Encodes a header block as a HEADERS frame followed by as many CONTINUATION
+// frames as max_frame_size requires
+std::string http2_encode_headers(uint32_t stream_id, const std::string &block, bool end_stream,
+        uint32_t max_frame_size);
+
+// Conversions between HTTP/1 messages and HTTP/2 header lists, which carry the
+// request line and status in pseudo-headers and use lower case names
+std::vector<HttpHeader> http2_request_headers(const HttpRequest &request);
+HttpRequest http2_request_from_headers(const std::vector<HttpHeader> &headers);
+std::vector<HttpHeader> http2_response_headers(const HttpResponse &response);
+HttpResponse http2_response_from_headers(const std::vector<HttpHeader> &headers);
+
+// Decodes the base64url HTTP2-Settings header of an h2c upgrade request
+std::string http2_decode_settings_header(const std::string &value);
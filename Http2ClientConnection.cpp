@@ -0,0 +1,234 @@
+#include "Http2ClientConnection.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <deque>
+#include <map>
+
+// We read whole bodies into memory, so a generous window costs nothing extra
+static const uint32_t receive_window_size = 1 << 20;
+static const int timeout_ms = 30000;
+
+void Http2ClientConnection::flush() {
+    while (!output.empty()) {
+        ssize_t sent = send(fd, output.data(), output.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Connection error");
+        }
+        output.erase(0, sent);
+    }
+}
+
+bool Http2ClientConnection::receive() {
+    pollfd p = {};
+    p.fd = fd;
+    p.events = POLLIN;
+    if (poll(&p, 1, timeout_ms) <= 0) {
+        return false;
+    }
+    char buffer[16384];
+    ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytes_received <= 0) {
+        return false;
+    }
+    input.append(buffer, bytes_received);
+    return true;
+}
+
+std::vector<Http2ClientConnection::Result> Http2ClientConnection::fetch(
+        const std::vector<HttpRequest> &requests) {
+    struct Stream {
+        size_t request_index;
+        bool has_response = false;
+        std::string body;
+    };
+
+    std::vector<Result> results(requests.size());
+    std::deque<size_t> pending;
+    for (size_t i = 0; i < requests.size(); i++) {
+        pending.push_back(i);
+    }
+    std::map<uint32_t, Stream> streams;
+    uint32_t next_stream_id = 1;
+    size_t completed = 0;
+
+    output = http2_preface;
+    output += http2_encode_frame(Http2FrameType::SETTINGS, 0, 0, http2_encode_settings({
+        {Http2Setting::ENABLE_PUSH, 0},
+        {Http2Setting::INITIAL_WINDOW_SIZE, receive_window_size},
+    }));
+    output += http2_encode_frame(Http2FrameType::WINDOW_UPDATE, 0, 0,
+                                 http2_encode_uint32(receive_window_size
+                                                     - http2_default_window_size));
+
+    // A header block split over HEADERS and CONTINUATION frames
+    std::string header_block;
+    uint32_t header_stream_id = 0;
+    bool header_end_stream = false;
+    bool header_block_open = false;
+
+    auto finish = [&] (uint32_t stream_id, const std::string &error) {
+        auto it = streams.find(stream_id);
+        if (it == streams.end()) {
+            return;
+        }
+        Result &result = results[it->second.request_index];
+        result.error = error;
+        if (error.empty()) {
+            result.response.setBody(it->second.body);
+        }
+        streams.erase(it);
+        completed++;
+    };
+
+    try {
+        while (completed < requests.size()) {
+            // Open as many streams as the server allows
+            while (!pending.empty() && streams.size() < peer_max_concurrent_streams) {
+                size_t index = pending.front();
+                pending.pop_front();
+                Stream stream;
+                stream.request_index = index;
+                streams[next_stream_id] = stream;
+                std::string block = encoder.encode(http2_request_headers(requests[index]));
+                output += http2_encode_headers(next_stream_id, block, true, peer_max_frame_size);
+                next_stream_id += 2;
+            }
+            flush();
+
+            if (!receive()) {
+                throw std::runtime_error("Connection closed by server");
+            }
+            size_t offset = 0;
+            Http2Frame frame;
+            while (http2_parse_frame(input, offset, http2_default_max_frame_size, frame)) {
+                if (header_block_open && (frame.type != Http2FrameType::CONTINUATION
+                                          || frame.stream_id != header_stream_id)) {
+                    throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR,
+                                               "Expected CONTINUATION");
+                }
+
+                switch (frame.type) {
+                    case Http2FrameType::SETTINGS:
+                        if (frame.hasFlag(Http2Flags::ACK)) {
+                            break;
+                        }
+                        for (const auto &setting : http2_parse_settings(frame.payload)) {
+                            if (setting.first == Http2Setting::MAX_CONCURRENT_STREAMS) {
+                                peer_max_concurrent_streams = setting.second;
+                            } else if (setting.first == Http2Setting::HEADER_TABLE_SIZE) {
+                                encoder.setMaxTableSize(setting.second);
+                            } else if (setting.first == Http2Setting::MAX_FRAME_SIZE) {
+                                peer_max_frame_size = setting.second;
+                            }
+                        }
+                        output += http2_encode_frame(Http2FrameType::SETTINGS, Http2Flags::ACK,
+                                                     0, "");
+                        break;
+                    case Http2FrameType::PING:
+                        if (!frame.hasFlag(Http2Flags::ACK)) {
+                            output += http2_encode_frame(Http2FrameType::PING, Http2Flags::ACK,
+                                                         0, frame.payload);
+                        }
+                        break;
+                    case Http2FrameType::HEADERS:
+                    case Http2FrameType::CONTINUATION:
+                        if (frame.type == Http2FrameType::HEADERS) {
+                            http2_strip_padding(frame);
+                            header_stream_id = frame.stream_id;
+                            header_end_stream = frame.hasFlag(Http2Flags::END_STREAM);
+                            header_block.clear();
+                        } else if (!header_block_open) {
+                            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR,
+                                                       "Unexpected CONTINUATION");
+                        }
+                        header_block += frame.payload;
+                        header_block_open = !frame.hasFlag(Http2Flags::END_HEADERS);
+                        if (!header_block_open) {
+                            std::vector<HttpHeader> headers;
+                            try {
+                                headers = decoder.decode(header_block);
+                            } catch (const std::runtime_error &e) {
+                                throw Http2ConnectionError(Http2Error::COMPRESSION_ERROR,
+                                                           e.what());
+                            }
+                            auto it = streams.find(header_stream_id);
+                            if (it == streams.end()) {
+                                break;
+                            }
+                            if (!it->second.has_response) {
+                                HttpResponse response = http2_response_from_headers(headers);
+                                // Skip interim responses, like 100 Continue
+                                if (http_status_code(response.getStatusCode()) >= 200) {
+                                    results[it->second.request_index].response = response;
+                                    it->second.has_response = true;
+                                }
+                            }
+                            if (header_end_stream) {
+                                finish(header_stream_id, it->second.has_response
+                                       ? "" : "Stream ended without a response");
+                            }
+                        }
+                        break;
+                    case Http2FrameType::DATA: {
+                        uint32_t length = frame.payload.size();
+                        http2_strip_padding(frame);
+                        if (length > 0) {
+                            output += http2_encode_frame(Http2FrameType::WINDOW_UPDATE, 0, 0,
+                                                         http2_encode_uint32(length));
+                        }
+                        auto it = streams.find(frame.stream_id);
+                        if (it == streams.end()) {
+                            break;
+                        }
+                        it->second.body += frame.payload;
+                        if (frame.hasFlag(Http2Flags::END_STREAM)) {
+                            finish(frame.stream_id, "");
+                        } else if (length > 0) {
+                            output += http2_encode_frame(Http2FrameType::WINDOW_UPDATE, 0,
+                                                         frame.stream_id,
+                                                         http2_encode_uint32(length));
+                        }
+                        break;
+                    }
+                    case Http2FrameType::RST_STREAM: {
+                        auto it = streams.find(frame.stream_id);
+                        if (it == streams.end() || frame.payload.size() != 4) {
+                            break;
+                        }
+                        // Refused streams were never processed, so try them again
+                        uint32_t code = http2_parse_uint32(frame.payload, 0);
+                        if (code == static_cast<uint32_t>(Http2Error::REFUSED_STREAM)) {
+                            pending.push_back(it->second.request_index);
+                            streams.erase(it);
+                        } else {
+                            finish(frame.stream_id,
+                                   "Stream reset by server, error " + std::to_string(code));
+                        }
+                        break;
+                    }
+                    case Http2FrameType::GOAWAY:
+                        throw std::runtime_error("Server closed the connection");
+                    default:
+                        break;
+                }
+            }
+            input.erase(0, offset);
+        }
+        flush();
+    } catch (const std::runtime_error &e) {
+        // Everything not yet complete fails
+        for (auto &stream : streams) {
+            results[stream.second.request_index].error = e.what();
+        }
+        for (size_t index : pending) {
+            results[index].error = e.what();
+        }
+    }
+    return results;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Hpack.h"
+#include "Http2.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fetches several requests from one server over a single prior-knowledge h2c
+// connection, with as many streams open at once as the server allows.
+class Http2ClientConnection {
+ public:
+    struct Result {
+        HttpResponse response;
+        std::string error; // Empty if response is valid
+    };
+
+ private:
+    int fd;
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    std::string input;
+    std::string output;
+    uint32_t peer_max_concurrent_streams = 100;
+    uint32_t peer_max_frame_size = http2_default_max_frame_size;
+
+    void flush();
+    bool receive();
+
+ public:
+    // fd must be a connected, blocking socket. It is not closed.
+    Http2ClientConnection(int fd) : fd(fd) {}
+
+    // Returns a result for each request, in the same order
+    std::vector<Result> fetch(const std::vector<HttpRequest> &requests);
+};
@@ -0,0 +1,414 @@
+#include "Http2ServerConnection.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+
+// Give up on clients which neither send nor receive anything for this long
+static const int idle_timeout_ms = 5000;
+
+// Stop generating DATA frames once this much output is waiting, so that
+// streams stay interleaved and memory stays bounded
+static const size_t max_buffered_output = 64 * 1024;
+
+void Http2ServerConnection::run(const std::string &received) {
+    input = received;
+    output += http2_encode_frame(Http2FrameType::SETTINGS, 0, 0, http2_encode_settings({
+        {Http2Setting::MAX_CONCURRENT_STREAMS, static_cast<uint32_t>(max_streams)},
+    }));
+    loop();
+}
+
+void Http2ServerConnection::runUpgrade(const HttpRequest &request, const std::string &received) {
+    output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    output += http2_encode_frame(Http2FrameType::SETTINGS, 0, 0, http2_encode_settings({
+        {Http2Setting::MAX_CONCURRENT_STREAMS, static_cast<uint32_t>(max_streams)},
+    }));
+    try {
+        applySettings(http2_decode_settings_header(request.getHeader("HTTP2-Settings")));
+    } catch (const std::runtime_error &e) {
+        goAway(Http2Error::PROTOCOL_ERROR);
+    }
+
+    // The upgrade request becomes stream 1, half-closed from the client's side
+    if (!closing) {
+        last_stream_id = 1;
+        Stream stream;
+        stream.request = request;
+        stream.send_window = peer_initial_window_size;
+        streams[1] = stream;
+        dispatch(1);
+    }
+
+    input = received;
+    loop();
+}
+
+void Http2ServerConnection::loop() {
+    char buffer[16384];
+    bool peer_closed = false;
+    while (true) {
+        if (!closing) {
+            try {
+                processInput();
+                // After an upgrade, hold the body back until the client has
+                // switched protocols
+                if (preface_received) {
+                    queueData();
+                }
+            } catch (const Http2ConnectionError &e) {
+                goAway(e.code);
+            }
+        }
+        if (going_away && streams.empty()) {
+            closing = true;
+        }
+        if (output.empty() && (closing || peer_closed)) {
+            break;
+        }
+
+        pollfd p = {};
+        p.fd = fd;
+        p.events = (closing || peer_closed ? 0 : POLLIN) | (output.empty() ? 0 : POLLOUT);
+        int ready = poll(&p, 1, idle_timeout_ms);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        } else if (ready <= 0) {
+            break;
+        }
+
+        if (p.revents & POLLOUT) {
+            ssize_t sent = send(fd, output.data(), output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent > 0) {
+                output.erase(0, sent);
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                break;
+            }
+        }
+        if (p.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (bytes_received > 0) {
+                input.append(buffer, bytes_received);
+            } else if (bytes_received == 0) {
+                peer_closed = true;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                break;
+            }
+        }
+    }
+}
+
+void Http2ServerConnection::processInput() {
+    if (!preface_received) {
+        if (input.size() < http2_preface.size()) {
+            return;
+        }
+        if (input.compare(0, http2_preface.size(), http2_preface) != 0) {
+            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Missing client preface");
+        }
+        input.erase(0, http2_preface.size());
+        preface_received = true;
+    }
+
+    size_t offset = 0;
+    Http2Frame frame;
+    while (!closing && http2_parse_frame(input, offset, http2_default_max_frame_size, frame)) {
+        handleFrame(frame);
+    }
+    input.erase(0, offset);
+}
+
+void Http2ServerConnection::handleFrame(Http2Frame &frame) {
+    if (header_block_open && (frame.type != Http2FrameType::CONTINUATION
+                              || frame.stream_id != header_stream_id)) {
+        throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Expected CONTINUATION");
+    }
+
+    switch (frame.type) {
+        case Http2FrameType::HEADERS:
+            if (frame.stream_id == 0 || frame.stream_id % 2 == 0) {
+                throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Invalid stream id");
+            }
+            http2_strip_padding(frame);
+            header_stream_id = frame.stream_id;
+            header_end_stream = frame.hasFlag(Http2Flags::END_STREAM);
+            header_block = frame.payload;
+            header_block_open = !frame.hasFlag(Http2Flags::END_HEADERS);
+            if (!header_block_open) {
+                handleHeaderBlock();
+            }
+            break;
+        case Http2FrameType::CONTINUATION:
+            if (!header_block_open) {
+                throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Unexpected CONTINUATION");
+            }
+            header_block += frame.payload;
+            header_block_open = !frame.hasFlag(Http2Flags::END_HEADERS);
+            if (!header_block_open) {
+                handleHeaderBlock();
+            }
+            break;
+        case Http2FrameType::DATA:
+            handleData(frame);
+            break;
+        case Http2FrameType::SETTINGS:
+            if (frame.stream_id != 0) {
+                throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "SETTINGS on a stream");
+            }
+            if (!frame.hasFlag(Http2Flags::ACK)) {
+                applySettings(frame.payload);
+                output += http2_encode_frame(Http2FrameType::SETTINGS, Http2Flags::ACK, 0, "");
+            }
+            break;
+        case Http2FrameType::PING:
+            if (frame.payload.size() != 8) {
+                throw Http2ConnectionError(Http2Error::FRAME_SIZE_ERROR, "Malformed PING");
+            }
+            if (!frame.hasFlag(Http2Flags::ACK)) {
+                output += http2_encode_frame(Http2FrameType::PING, Http2Flags::ACK, 0,
+                                             frame.payload);
+            }
+            break;
+        case Http2FrameType::WINDOW_UPDATE:
+            handleWindowUpdate(frame);
+            break;
+        case Http2FrameType::RST_STREAM:
+            streams.erase(frame.stream_id);
+            break;
+        case Http2FrameType::GOAWAY:
+            going_away = true;
+            break;
+        case Http2FrameType::PUSH_PROMISE:
+            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "PUSH_PROMISE from client");
+        default: // PRIORITY, and unknown frame types, are ignored
+            break;
+    }
+}
+
+void Http2ServerConnection::handleHeaderBlock() {
+    // Decode even blocks we are going to refuse, to keep HPACK state in sync
+    std::vector<HttpHeader> headers;
+    try {
+        headers = decoder.decode(header_block);
+    } catch (const std::runtime_error &e) {
+        throw Http2ConnectionError(Http2Error::COMPRESSION_ERROR, e.what());
+    }
+    uint32_t stream_id = header_stream_id;
+
+    auto it = streams.find(stream_id);
+    if (it != streams.end()) {
+        // Trailers, which we have no use for, ending the request
+        if (it->second.request_complete || !header_end_stream) {
+            resetStream(stream_id, Http2Error::PROTOCOL_ERROR);
+        } else {
+            dispatch(stream_id);
+        }
+        return;
+    }
+    if (stream_id <= last_stream_id) {
+        throw Http2ConnectionError(Http2Error::STREAM_CLOSED, "HEADERS on a closed stream");
+    }
+    last_stream_id = stream_id;
+
+    if (going_away || streams.size() >= max_streams) {
+        resetStream(stream_id, Http2Error::REFUSED_STREAM);
+        return;
+    }
+    Stream stream;
+    try {
+        stream.request = http2_request_from_headers(headers);
+    } catch (const std::runtime_error &e) {
+        resetStream(stream_id, Http2Error::PROTOCOL_ERROR);
+        return;
+    }
+    stream.send_window = peer_initial_window_size;
+    streams[stream_id] = stream;
+    if (header_end_stream) {
+        dispatch(stream_id);
+    }
+}
+
+void Http2ServerConnection::handleData(Http2Frame &frame) {
+    if (frame.stream_id == 0) {
+        throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "DATA on stream 0");
+    }
+    // Request bodies are discarded, so hand the flow control credit straight back
+    uint32_t length = frame.payload.size();
+    if (length > 0) {
+        output += http2_encode_frame(Http2FrameType::WINDOW_UPDATE, 0, 0,
+                                     http2_encode_uint32(length));
+    }
+    http2_strip_padding(frame);
+
+    auto it = streams.find(frame.stream_id);
+    if (it == streams.end() || it->second.request_complete) {
+        if (frame.stream_id > last_stream_id) {
+            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "DATA on an idle stream");
+        }
+        resetStream(frame.stream_id, Http2Error::STREAM_CLOSED);
+        return;
+    }
+    if (frame.hasFlag(Http2Flags::END_STREAM)) {
+        dispatch(frame.stream_id);
+    } else if (length > 0) {
+        output += http2_encode_frame(Http2FrameType::WINDOW_UPDATE, 0, frame.stream_id,
+                                     http2_encode_uint32(length));
+    }
+}
+
+void Http2ServerConnection::handleWindowUpdate(const Http2Frame &frame) {
+    if (frame.payload.size() != 4) {
+        throw Http2ConnectionError(Http2Error::FRAME_SIZE_ERROR, "Malformed WINDOW_UPDATE");
+    }
+    uint32_t increment = http2_parse_uint32(frame.payload, 0) & 0x7fffffff;
+    if (frame.stream_id == 0) {
+        if (increment == 0) {
+            throw Http2ConnectionError(Http2Error::PROTOCOL_ERROR, "Zero WINDOW_UPDATE");
+        }
+        connection_send_window += increment;
+        if (connection_send_window > http2_max_window_size) {
+            throw Http2ConnectionError(Http2Error::FLOW_CONTROL_ERROR, "Window overflow");
+        }
+        return;
+    }
+
+    auto it = streams.find(frame.stream_id);
+    if (it == streams.end()) {
+        return; // Streams we have finished with may still get updates
+    }
+    if (increment == 0) {
+        resetStream(frame.stream_id, Http2Error::PROTOCOL_ERROR);
+        return;
+    }
+    it->second.send_window += increment;
+    if (it->second.send_window > http2_max_window_size) {
+        resetStream(frame.stream_id, Http2Error::FLOW_CONTROL_ERROR);
+    }
+}
+
+void Http2ServerConnection::applySettings(const std::string &payload) {
+    for (const auto &setting : http2_parse_settings(payload)) {
+        switch (setting.first) {
+            case Http2Setting::HEADER_TABLE_SIZE:
+                encoder.setMaxTableSize(setting.second);
+                break;
+            case Http2Setting::INITIAL_WINDOW_SIZE: {
+                // Applies retroactively to the windows of open streams
+                int64_t delta = static_cast<int64_t>(setting.second) - peer_initial_window_size;
+                for (auto &stream : streams) {
+                    stream.second.send_window += delta;
+                    if (stream.second.send_window > http2_max_window_size) {
+                        throw Http2ConnectionError(Http2Error::FLOW_CONTROL_ERROR,
+                                                   "Window overflow");
+                    }
+                }
+                peer_initial_window_size = setting.second;
+                break;
+            }
+            case Http2Setting::MAX_FRAME_SIZE:
+                peer_max_frame_size = setting.second;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void Http2ServerConnection::dispatch(uint32_t stream_id) {
+    Stream &stream = streams[stream_id];
+    stream.request_complete = true;
+
+    HttpResponse response = server.processRequest(stream.request);
+    std::string block = encoder.encode(http2_response_headers(response));
+    stream.body = response.getBody();
+    stream.body_reader = response.getBodyReader();
+    bool end_stream = stream.body.empty() && !stream.body_reader;
+    if (stream.body_reader && response.hasHeader("Content-Length")) {
+        stream.length_known = true;
+        stream.remaining = std::stoull(response.getHeader("Content-Length"));
+        end_stream = stream.remaining == 0;
+    }
+    output += http2_encode_headers(stream_id, block, end_stream, peer_max_frame_size);
+    if (end_stream) {
+        streams.erase(stream_id);
+    }
+}
+
+// Refills a streamed body with up to size bytes. Returns false if the reader
+// fails, or ends short of the Content-Length.
+bool Http2ServerConnection::readBody(Stream &stream, size_t size) {
+    if (stream.length_known) {
+        size = std::min<unsigned long long>(size, stream.remaining);
+    }
+    stream.body.resize(size);
+    stream.body_offset = 0;
+    ssize_t bytes_read = stream.body_reader(&stream.body[0], size);
+    if (bytes_read < 0 || (bytes_read == 0 && stream.length_known)) {
+        return false;
+    }
+    stream.body.resize(bytes_read);
+    if (stream.length_known) {
+        stream.remaining -= bytes_read;
+    }
+    if (bytes_read == 0 || (stream.length_known && stream.remaining == 0)) {
+        stream.body_reader = HttpResponse::BodyReader();
+    }
+    return true;
+}
+
+void Http2ServerConnection::queueData() {
+    bool progress = true;
+    while (progress && output.size() < max_buffered_output && connection_send_window > 0) {
+        progress = false;
+        for (auto it = streams.begin(); it != streams.end() && connection_send_window > 0;) {
+            Stream &stream = it->second;
+            if (!stream.request_complete || stream.send_window <= 0) {
+                it++;
+                continue;
+            }
+
+            size_t length = std::min<size_t>(peer_max_frame_size, stream.send_window);
+            length = std::min<size_t>(length, connection_send_window);
+            if (stream.body_offset == stream.body.size() && stream.body_reader
+                    && !readBody(stream, length)) {
+                output += http2_encode_frame(Http2FrameType::RST_STREAM, 0, it->first,
+                    http2_encode_uint32(static_cast<uint32_t>(Http2Error::INTERNAL_ERROR)));
+                it = streams.erase(it);
+                continue;
+            }
+            // A streamed body of unknown length ends with an empty frame, once
+            // the reader has run dry
+            size_t remaining = stream.body.size() - stream.body_offset;
+            length = std::min(length, remaining);
+            bool last = length == remaining && !stream.body_reader;
+            output += http2_encode_frame(Http2FrameType::DATA,
+                                         last ? Http2Flags::END_STREAM : 0, it->first,
+                                         stream.body.substr(stream.body_offset, length));
+            stream.body_offset += length;
+            stream.send_window -= length;
+            connection_send_window -= length;
+            progress = true;
+
+            if (last) {
+                it = streams.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+}
+
+void Http2ServerConnection::resetStream(uint32_t stream_id, Http2Error code) {
+    output += http2_encode_frame(Http2FrameType::RST_STREAM, 0, stream_id,
+                                 http2_encode_uint32(static_cast<uint32_t>(code)));
+    streams.erase(stream_id);
+}
+
+void Http2ServerConnection::goAway(Http2Error code) {
+    output += http2_encode_frame(Http2FrameType::GOAWAY, 0, 0,
+                                 http2_encode_uint32(last_stream_id)
+                                 + http2_encode_uint32(static_cast<uint32_t>(code)));
+    closing = true;
+}
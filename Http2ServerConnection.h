@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Hpack.h"
+#include "Http2.h"
+#include "HttpRequest.h"
+#include "SimpleHttpServer.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Serves one h2c connection. Every stream's request is answered with
+// SimpleHttpServer::processRequest, and response bodies are interleaved
+// round-robin, one DATA frame per stream at a time, within the flow control
+// windows the client grants. Streamed bodies are only read as they can be
+// sent.
+class Http2ServerConnection {
+ private:
+    struct Stream {
+        HttpRequest request;
+        bool request_complete = false;
+        std::string body; // Response body, once the request has been processed
+        size_t body_offset = 0;
+        // Streamed bodies are read into body a frame at a time, as the flow
+        // control windows allow. remaining is the rest of the Content-Length.
+        HttpResponse::BodyReader body_reader;
+        bool length_known = false;
+        unsigned long long remaining = 0;
+        int64_t send_window = http2_default_window_size;
+    };
+
+    const SimpleHttpServer &server;
+    int fd;
+    size_t max_streams;
+
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::map<uint32_t, Stream> streams;
+    std::string input;
+    std::string output;
+
+    int64_t connection_send_window = http2_default_window_size;
+    uint32_t peer_initial_window_size = http2_default_window_size;
+    uint32_t peer_max_frame_size = http2_default_max_frame_size;
+    uint32_t last_stream_id = 0;
+    bool preface_received = false;
+    bool going_away = false; // No new streams, finish the current ones
+    bool closing = false;    // Close once output has been flushed
+
+    // A header block being received, split over HEADERS and CONTINUATION frames
+    uint32_t header_stream_id = 0;
+    bool header_end_stream = false;
+    bool header_block_open = false;
+    std::string header_block;
+
+    void loop();
+    void processInput();
+    void handleFrame(Http2Frame &frame);
+    void handleHeaderBlock();
+    void handleData(Http2Frame &frame);
+    void handleWindowUpdate(const Http2Frame &frame);
+    void applySettings(const std::string &payload);
+    void dispatch(uint32_t stream_id);
+    void queueData();
+    bool readBody(Stream &stream, size_t size);
+    void resetStream(uint32_t stream_id, Http2Error code);
+    void goAway(Http2Error code);
+
+ public:
+    Http2ServerConnection(const SimpleHttpServer &server, int fd, size_t max_streams)
+        : server(server), fd(fd), max_streams(max_streams) {}
+
+    // Serves a prior-knowledge connection. received holds the bytes read so
+    // far, starting with the client preface. Does not close fd.
+    void run(const std::string &received);
+
+    // Serves a connection upgraded from HTTP/1.1, answering request on
+    // stream 1. received holds any bytes read after the request.
+    void runUpgrade(const HttpRequest &request, const std::string &received);
+};
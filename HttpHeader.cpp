@@ -1,23 +1,25 @@
 #include "HttpHeader.h"
+#include "HttpWire.h"
+#include "Scan.h"
 
 #include <algorithm>
+#include <cctype>
 
-inline void trim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [] (char c) {
-        return !std::isspace(c);
-    }));
-    s.erase(std::find_if(s.rbegin(), s.rend(), [] (char c) {
-        return !std::isspace(c);
-    }).base(), s.end());
+HttpHeader HttpHeader::fromString(const std::string &string) {
+    const char *begin = string.data();
+    const char *end = begin + string.size();
+    const char *colon = scan_byte(begin, end, ':');
+    std::string name(begin, colon);
+    std::string value(colon == end ? end : colon + 1, end);
+    return HttpHeader(http_trim(name), http_trim(value));
 }
 
-HttpHeader HttpHeader::fromString(const std::string &string) {
-    auto semicolon_pos = string.find(":");
-    auto name = string.substr(0, semicolon_pos);
-    auto value = string.substr(semicolon_pos+1);
-    trim(name);
-    trim(value);
-    return HttpHeader(name, value);
+bool HttpHeader::hasName(const std::string &other) const {
+    return this->name.size() == other.size()
+        && std::equal(this->name.begin(), this->name.end(), other.begin(), [] (char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a))
+                == std::tolower(static_cast<unsigned char>(b));
+        });
 }
 
 std::string HttpHeader::toString() const {
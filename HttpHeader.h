@@ -10,6 +10,9 @@ class HttpHeader {
     HttpHeader() {}
     HttpHeader(const std::string &name, const std::string &value) : name(name), value(value) {}
 
+    // Header names are case-insensitive
+    bool hasName(const std::string &other) const;
+
     std::string toString() const;
     static HttpHeader fromString(const std::string &string);
 };
@@ -1,12 +1,13 @@
 #include "HttpRequest.h"
+#include "Scan.h"
 
-#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 std::string HttpRequest::getHost() const {
     for (const HttpHeader &header : headers) {
-        if (header.name == "Host") {
+        if (header.hasName("Host")) {
             return header.value;
         }
     }
@@ -15,7 +16,7 @@ std::string HttpRequest::getHost() const {
 
 void HttpRequest::setHost(const std::string &host) {
     for (HttpHeader &header : headers) {
-        if (header.name == "Host") {
+        if (header.hasName("Host")) {
             header.value = host;
             return;
         }
@@ -25,7 +26,7 @@ void HttpRequest::setHost(const std::string &host) {
 
 bool HttpRequest::hasHeader(const std::string &name) const {
     for (const HttpHeader &header : headers) {
-        if (header.name == name) {
+        if (header.hasName(name)) {
             return true;
         }
     }
@@ -34,7 +35,7 @@ bool HttpRequest::hasHeader(const std::string &name) const {
 
 std::string HttpRequest::getHeader(const std::string &name) const {
     for (const HttpHeader &header : headers) {
-        if (header.name == name) {
+        if (header.hasName(name)) {
             return header.value;
         }
     }
@@ -47,7 +48,7 @@ void HttpRequest::addHeader(const std::string &headerName, const std::string &he
 
 void HttpRequest::addHeader(const HttpHeader &header) {
     for (HttpHeader &h : headers) {
-        if (h.name == header.name) {
+        if (h.hasName(header.name)) {
             h.value = header.value;
             return;
         }
@@ -56,54 +57,53 @@ void HttpRequest::addHeader(const HttpHeader &header) {
 }
 
 std::string HttpRequest::encode() const {
-    std::stringstream ss;
-    ss << method << " " << path << " " << version << "\r\n";
+    std::string result;
+    result.reserve(128);
+    result += http_method_name(method);
+    result += " " + path + " " + version + "\r\n";
     for (const HttpHeader &header : this->headers) {
-        ss << header.toString() << "\r\n";
+        result += header.toString();
+        result += "\r\n";
     }
-    ss << "\r\n";
-    return ss.str();
+    result += "\r\n";
+    return result;
 }
 
 HttpRequest HttpRequest::consume(const std::string &wire) {
     HttpRequest result;
 
-    bool found_empty_line = false;
+    // Split the header block, up to the blank line, into lines
+    const char *begin = wire.data();
+    const char *end = begin + wire.size();
+    const char *header_end = scan_header_end(begin, end);
     std::vector<std::string> lines;
-    int previous_line_end = 0;
-    for (size_t i = previous_line_end + 1; i < wire.size(); i++) {
-        if (wire[i-1] == '\r' && wire[i] == '\n') {
-            std::string s(wire.begin() + previous_line_end,
-                          wire.begin() + i-1);
-            if (s.empty()) {
-                found_empty_line = true;
-                break;
-            }
-            lines.push_back(s);
-            previous_line_end = i + 1;
-            i++;
+    if (header_end != end) {
+        const char *last_line_end = header_end + 2;
+        for (const char *line = begin; line < last_line_end;) {
+            const char *line_end = scan_crlf(line, last_line_end);
+            lines.push_back(std::string(line, line_end));
+            line = line_end + 2;
         }
     }
-    if (!found_empty_line || lines.size() < 2) {
+    if (header_end == end || lines.size() < 2) {
         throw std::runtime_error("Malformed request");
     }
 
     std::vector<std::string> first_line_words;
-    int previous_word_end = 0;
-    for (size_t i = 0; i < lines[0].size(); i++) {
-        if (lines[0][i] == ' '){
-            std::string ss = lines[0].substr(previous_word_end, i-previous_word_end);
-            first_line_words.push_back(ss);
-            previous_word_end= i+1;
+    const char *line_end = lines[0].data() + lines[0].size();
+    for (const char *word = lines[0].data(); ; ) {
+        const char *word_end = scan_byte(word, line_end, ' ');
+        first_line_words.push_back(std::string(word, word_end));
+        if (word_end == line_end) {
+            break;
         }
+        word = word_end + 1;
     }
-    first_line_words.push_back(lines[0].substr(previous_word_end,
-                                               lines[0].size()-previous_word_end));
     if (first_line_words.size() != 3) {
         throw std::runtime_error("Malformed request");
     }
 
-    result.setMethod(first_line_words[0]);
+    result.setMethod(http_method_from_name(first_line_words[0]));
     result.setPath(first_line_words[1]);
     result.setHttpVersion(first_line_words[2]);
 
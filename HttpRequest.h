@@ -1,20 +1,21 @@
 #pragma once
 
 #include "HttpHeader.h"
+#include "HttpTypes.h"
 
 #include <string>
 #include <vector>
 
 class HttpRequest{
  private:
-    std::string method;
+    HttpMethod method;
     std::string path;
     std::string version;
     std::vector<HttpHeader> headers;
 
  public:
-    HttpRequest() : HttpRequest("GET", "/", "HTTP/1.0", "localhost") {}
-    HttpRequest(const std::string& method,
+    HttpRequest() : HttpRequest(HttpMethod::GET, "/", "HTTP/1.0", "localhost") {}
+    HttpRequest(HttpMethod method,
             const std::string &path,
             const std::string &version,
             std::string host)
@@ -22,8 +23,8 @@ class HttpRequest{
             addHeader("Host", host);
         }
 
-    std::string getMethod() const { return this->method; }
-    void setMethod(std::string methodName) { this->method = methodName; }
+    HttpMethod getMethod() const { return this->method; }
+    void setMethod(HttpMethod method) { this->method = method; }
 
     std::string getPath() const { return this->path; }
     void setPath(std::string path) { this->path = path; }
@@ -34,6 +35,7 @@ class HttpRequest{
     std::string getHost() const;
     void setHost(const std::string &host);
 
+    const std::vector<HttpHeader> &getHeaders() const { return this->headers; }
     bool hasHeader(const std::string &name) const;
     std::string getHeader(const std::string &name) const;
     void addHeader(const std::string &headerName, const std::string &headerValue);
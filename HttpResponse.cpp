@@ -1,61 +1,108 @@
 #include "HttpResponse.h"
+#include "Scan.h"
 
-#include <sstream>
+#include <stdexcept>
+
+HttpResponse HttpResponse::error(HttpStatus status_code, const std::string &http_version) {
+    bool http11 = http_version == "HTTP/1.1";
+    HttpResponse response(status_code, http11 ? "HTTP/1.1" : "HTTP/1.0");
+    if (status_code == HttpStatus::ServiceUnavailable) {
+        response.addHeader("Retry-After", "1");
+    }
+    response.addHeader("Content-Length", "0");
+    response.addHeader("Connection", "close");
+
+    const HttpStatusInfo *info = http_status_info(status_code);
+    if (info != nullptr) {
+        response.pre_serialized = http11 ? info->http11_error_response : info->error_response;
+    }
+    return response;
+}
 
 std::string HttpResponse::encode() const {
-    std::stringstream ss;
-    ss << http_version << " " << status_code << "\r\n";
+    if (!pre_serialized.empty()) {
+        return pre_serialized.toString();
+    }
+    std::string result = encodeHead();
+    result += body;
+    return result;
+}
+
+std::string HttpResponse::encodeHead() const {
+    // Pre-serialized responses have no body
+    if (!pre_serialized.empty()) {
+        return pre_serialized.toString();
+    }
+
+    std::string result;
+    result.reserve(128);
+    const HttpStatusInfo *info = http_status_info(status_code);
+    if (info != nullptr && http_version == "HTTP/1.0") {
+        result.append(info->status_line.data, info->status_line.size);
+    } else if (info != nullptr && http_version == "HTTP/1.1") {
+        result.append(info->http11_status_line.data, info->http11_status_line.size);
+    } else {
+        // The reason phrase may be empty, but the space before it may not
+        result += http_version + " " + std::to_string(http_status_code(status_code)) + " ";
+        if (info != nullptr) {
+            result.append(info->reason.data, info->reason.size);
+        }
+        result += "\r\n";
+    }
     for (const HttpHeader &header : this->headers) {
-        ss << header.toString() << "\r\n";
+        result += header.name;
+        result += ": ";
+        result += header.value;
+        result += "\r\n";
     }
-    ss << "\r\n";
-    ss << body;
-    return ss.str();
+    result += "\r\n";
+    return result;
 }
 
 HttpResponse HttpResponse::consume(std::string wire){
     HttpResponse result;
 
-    bool found_empty_line = false;
+    // Split the header block, up to the blank line, into lines
+    const char *begin = wire.data();
+    const char *end = begin + wire.size();
+    const char *header_end = scan_header_end(begin, end);
     std::vector<std::string> lines;
-    int previous_line_end = 0;
-    for (size_t i = previous_line_end + 1; i < wire.size(); i++) {
-        if (wire[i-1] == '\r' && wire[i] == '\n') {
-            std::string s(wire.begin() + previous_line_end,
-                          wire.begin() + i-1);
-            if (s.empty()) {
-                found_empty_line = true;
-                break;
-            }
-            lines.push_back(s);
-            previous_line_end = i + 1;
-            i++;
+    if (header_end != end) {
+        const char *last_line_end = header_end + 2;
+        for (const char *line = begin; line < last_line_end;) {
+            const char *line_end = scan_crlf(line, last_line_end);
+            lines.push_back(std::string(line, line_end));
+            line = line_end + 2;
         }
     }
-    if (!found_empty_line || lines.size() < 1) {
+    if (header_end == end || lines.size() < 1) {
         throw std::runtime_error("Malformed response");
     }
 
     std::vector<std::string> first_line_words;
-    int previous_word_end = 0;
-    for (size_t i = 0; i < lines[0].size(); i++) {
-        if (lines[0][i] == ' '){
-            std::string ss = lines[0].substr(previous_word_end, i-previous_word_end);
-            first_line_words.push_back(ss);
-            previous_word_end= i+1;
+    const char *line_end = lines[0].data() + lines[0].size();
+    for (const char *word = lines[0].data(); ; ) {
+        const char *word_end = scan_byte(word, line_end, ' ');
+        first_line_words.push_back(std::string(word, word_end));
+        if (word_end == line_end) {
+            break;
         }
+        word = word_end + 1;
     }
-    first_line_words.push_back(lines[0].substr(previous_word_end,
-                                               lines[0].size()-previous_word_end));
     if (first_line_words.size() < 2) {
         throw std::runtime_error("Malformed response");
     }
 
-    result.setStatusCode(first_line_words[1]);
+    try {
+        result.setStatusCode(http_status_from_code(std::stoi(first_line_words[1])));
+    } catch (const std::logic_error&) {
+        throw std::runtime_error("Malformed response");
+    }
+    result.setVersion(first_line_words[0]);
     for (size_t i = 1; i < lines.size(); i++) {
         result.addHeader(HttpHeader::fromString(lines[i]));
     }
-    result.setBody(wire.substr(previous_line_end));
+    result.setBody(wire.substr(header_end + 4 - begin));
     return result;
 }
 
@@ -64,8 +111,9 @@ void HttpResponse::addHeader(const std::string &headerName, const std::string &h
 }
 
 void HttpResponse::addHeader(const HttpHeader &header) {
+    this->pre_serialized = StaticBytes();
     for (HttpHeader &h : headers) {
-        if (h.name == header.name) {
+        if (h.hasName(header.name)) {
             h.value = header.value;
             return;
         }
@@ -75,7 +123,7 @@ void HttpResponse::addHeader(const HttpHeader &header) {
 
 bool HttpResponse::hasHeader(const std::string &name) const {
     for (const HttpHeader &header : headers) {
-        if (header.name == name) {
+        if (header.hasName(name)) {
             return true;
         }
     }
@@ -84,7 +132,7 @@ bool HttpResponse::hasHeader(const std::string &name) const {
 
 std::string HttpResponse::getHeader(const std::string &name) const {
     for (const HttpHeader &header : headers) {
-        if (header.name == name) {
+        if (header.hasName(name)) {
             return header.value;
         }
     }
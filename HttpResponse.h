@@ -1,36 +1,81 @@
 #pragma once
 
 #include "HttpHeader.h"
+#include "HttpTypes.h"
 
+#include <sys/types.h>
+
+#include <functional>
 #include <string>
 #include <vector>
 
 class HttpResponse {
+ public:
+    // Produces a body a piece at a time, filling up to size bytes of buffer.
+    // Returns the number of bytes produced, 0 at the end of the body, or -1
+    // if the body cannot be produced.
+    typedef std::function<ssize_t(char *buffer, size_t size)> BodyReader;
+
  private:
     std::vector<HttpHeader> headers;
-    std::string status_code;
+    HttpStatus status_code;
     std::string http_version;
     std::string body;
+    BodyReader body_reader;
+    // Set for responses made by error() until they are modified
+    StaticBytes pre_serialized;
 
  public:
-    HttpResponse() : HttpResponse("500", "HTTP/1.0") {}
-    HttpResponse(const std::string &status_code, const std::string &http_version)
+    HttpResponse() : HttpResponse(HttpStatus::InternalServerError, "HTTP/1.0") {}
+    HttpResponse(HttpStatus status_code, const std::string &http_version)
         : status_code(status_code), http_version(http_version) {}
 
-    std::string getStatusCode() { return this->status_code; }
-    void setStatusCode(const std::string &status_code) { this->status_code = status_code; }
+    // A bodiless error response which is sent from a compile-time table of
+    // pre-serialized responses when one exists for status. http_version may
+    // be HTTP/1.0 or HTTP/1.1.
+    static HttpResponse error(HttpStatus status_code,
+                              const std::string &http_version = "HTTP/1.0");
 
-    std::string getVersion() { return this->http_version; }
-    void setVersion(const std::string &version) { this->http_version = version; }
+    HttpStatus getStatusCode() const { return this->status_code; }
+    void setStatusCode(HttpStatus status_code) {
+        this->status_code = status_code;
+        this->pre_serialized = StaticBytes();
+    }
 
-    std::string getBody() { return this->body; }
-    void setBody(std::string body) { this->body = body; }
+    std::string getVersion() const { return this->http_version; }
+    void setVersion(const std::string &version) {
+        this->http_version = version;
+        this->pre_serialized = StaticBytes();
+    }
 
+    std::string getBody() const { return this->body; }
+    void setBody(std::string body) {
+        this->body = body;
+        this->pre_serialized = StaticBytes();
+    }
+
+    // Streams the body from reader instead, for bodies that are large or not
+    // known up front. Without a Content-Length header the sender frames it
+    // with chunked coding or by closing the connection.
+    bool hasBodyReader() const { return static_cast<bool>(this->body_reader); }
+    const BodyReader &getBodyReader() const { return this->body_reader; }
+    void setBodyReader(BodyReader reader) {
+        this->body_reader = reader;
+        this->pre_serialized = StaticBytes();
+    }
+
+    const std::vector<HttpHeader> &getHeaders() const { return this->headers; }
     bool hasHeader(const std::string &name) const;
     std::string getHeader(const std::string &name) const;
     void addHeader(const std::string &header_name, const std::string &header_value);
     void addHeader(const HttpHeader &header);
 
+    // The encoded response if it is available without any formatting work,
+    // otherwise empty
+    StaticBytes getPreSerialized() const { return this->pre_serialized; }
+
+    // The status line and headers, without the body
+    std::string encodeHead() const;
     std::string encode() const;
     static HttpResponse consume(std::string wire);
 };
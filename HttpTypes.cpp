@@ -0,0 +1,43 @@
+#include "HttpTypes.h"
+
+#include <stdexcept>
+
+static const char *const method_names[] = {
+    "GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH",
+};
+
+const HttpStatusInfo *http_status_info(HttpStatus status) {
+    for (const HttpStatusInfo &info : http_status_table) {
+        if (info.status == status) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+int http_status_code(HttpStatus status) {
+    return static_cast<int>(status);
+}
+
+HttpStatus http_status_from_code(int code) {
+    if (code < 100 || code > 599) {
+        throw std::out_of_range("Invalid status code " + std::to_string(code));
+    }
+    return static_cast<HttpStatus>(code);
+}
+
+const char *http_method_name(HttpMethod method) {
+    if (method == HttpMethod::Unknown) {
+        return "";
+    }
+    return method_names[static_cast<int>(method)];
+}
+
+HttpMethod http_method_from_name(const std::string &name) {
+    for (int i = 0; i < static_cast<int>(HttpMethod::Unknown); i++) {
+        if (name == method_names[i]) {
+            return static_cast<HttpMethod>(i);
+        }
+    }
+    return HttpMethod::Unknown;
+}
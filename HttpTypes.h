@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A string literal with its length worked out at compile time.
+struct StaticBytes {
+    const char *data;
+    size_t size;
+
+    constexpr StaticBytes() : data(nullptr), size(0) {}
+    template<size_t N>
+    constexpr StaticBytes(const char (&literal)[N]) : data(literal), size(N - 1) {}
+
+    bool empty() const { return size == 0; }
+    std::string toString() const { return std::string(data, size); }
+};
+
+enum class HttpMethod {
+    GET,
+    HEAD,
+    POST,
+    PUT,
+    DELETE,
+    CONNECT,
+    OPTIONS,
+    TRACE,
+    PATCH,
+    Unknown,
+};
+
+// Any numeric status code can be held; the named ones are those we know a
+// reason phrase for.
+enum class HttpStatus : int {
+    Ok = 200,
+    NotModified = 304,
+    BadRequest = 400,
+    NotFound = 404,
+    InternalServerError = 500,
+    NotImplemented = 501,
+    BadGateway = 502,
+    ServiceUnavailable = 503,
+};
+
+struct HttpStatusInfo {
+    HttpStatus status;
+    StaticBytes reason;
+    StaticBytes status_line;            // Complete HTTP/1.0 status line, with CRLF
+    StaticBytes http11_status_line;     // The same for HTTP/1.1
+    StaticBytes error_response;         // Complete response for errors we send, or empty
+    StaticBytes http11_error_response;  // The same for HTTP/1.1
+};
+
+// Headers shared by every pre-serialized error response
+#define HTTP_ERROR_HEADERS "Content-Length: 0\r\nConnection: close\r\n"
+
+#define HTTP_STATUS_ENTRY(name, code, reason) \
+    {HttpStatus::name, reason, "HTTP/1.0 " #code " " reason "\r\n", \
+     "HTTP/1.1 " #code " " reason "\r\n", {}, {}}
+#define HTTP_ERROR_ENTRY(name, code, reason, extra_headers) \
+    {HttpStatus::name, reason, "HTTP/1.0 " #code " " reason "\r\n", \
+     "HTTP/1.1 " #code " " reason "\r\n", \
+     "HTTP/1.0 " #code " " reason "\r\n" extra_headers HTTP_ERROR_HEADERS "\r\n", \
+     "HTTP/1.1 " #code " " reason "\r\n" extra_headers HTTP_ERROR_HEADERS "\r\n"}
+
+constexpr HttpStatusInfo http_status_table[] = {
+    HTTP_STATUS_ENTRY(Ok, 200, "OK"),
+    HTTP_STATUS_ENTRY(NotModified, 304, "Not Modified"),
+    HTTP_ERROR_ENTRY(BadRequest, 400, "Bad Request", ""),
+    HTTP_ERROR_ENTRY(NotFound, 404, "Not Found", ""),
+    HTTP_ERROR_ENTRY(InternalServerError, 500, "Internal Server Error", ""),
+    HTTP_ERROR_ENTRY(NotImplemented, 501, "Not Implemented", ""),
+    HTTP_ERROR_ENTRY(BadGateway, 502, "Bad Gateway", ""),
+    HTTP_ERROR_ENTRY(ServiceUnavailable, 503, "Service Unavailable", "Retry-After: 1\r\n"),
+};
+
+#undef HTTP_STATUS_ENTRY
+#undef HTTP_ERROR_ENTRY
+#undef HTTP_ERROR_HEADERS
+
+// Returns the table entry for status, or nullptr for unnamed status codes
+const HttpStatusInfo *http_status_info(HttpStatus status);
+
+int http_status_code(HttpStatus status);
+// Converts a received status code, which need not be a named one. Throws
+// std::out_of_range for codes outside 100-599.
+HttpStatus http_status_from_code(int code);
+
+const char *http_method_name(HttpMethod method);
+HttpMethod http_method_from_name(const std::string &name);
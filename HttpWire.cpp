@@ -0,0 +1,74 @@
+#include "HttpWire.h"
+#include "HttpHeader.h"
+#include "Scan.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+
+bool http_send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// The blank line may be split across reads, so each scan starts 3 bytes back
+size_t http_receive_header(int fd, std::string &received) {
+    char buffer[4096];
+    size_t scanned = 0;
+    while (true) {
+        const char *begin = received.data();
+        const char *end = begin + received.size();
+        const char *header_end = scan_header_end(begin + scanned, end);
+        if (header_end != end) {
+            return header_end - begin + 4;
+        }
+        scanned = received.size() < 3 ? 0 : received.size() - 3;
+        if (received.size() >= http_max_header_size) {
+            return std::string::npos;
+        }
+
+        ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), 0);
+        if (bytes_received <= 0) {
+            return std::string::npos;
+        }
+        received.append(buffer, bytes_received);
+    }
+}
+
+std::string http_trim(const std::string &s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+std::vector<std::string> http_split_list(const std::string &value) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = std::min(value.find(',', start), value.size());
+        std::string item = http_trim(value.substr(start, comma - start));
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+        start = comma + 1;
+    }
+    return items;
+}
+
+bool http_has_token(const std::string &list, const std::string &token) {
+    for (const std::string &item : http_split_list(list)) {
+        if (HttpHeader(item, "").hasName(token)) {
+            return true;
+        }
+    }
+    return false;
+}
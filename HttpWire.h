@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Helpers shared by the HTTP/1 server, client and proxy for moving messages
+// over sockets and picking apart header values.
+
+// Header blocks larger than this are refused
+const size_t http_max_header_size = 64 * 1024;
+
+// Sends all of data, returning false if the connection fails first
+bool http_send_all(int fd, const char *data, size_t size);
+
+// Reads from fd until received holds a whole header block, returning its
+// length, or std::string::npos if the connection closed or failed first or
+// the block is larger than http_max_header_size. received may already hold
+// the start of the block, or all of it, as with pipelined requests.
+size_t http_receive_header(int fd, std::string &received);
+
+// Strips the optional whitespace (spaces and tabs) around a header value
+std::string http_trim(const std::string &s);
+
+// Splits a comma-separated header value or option into its trimmed, non-empty
+// items
+std::vector<std::string> http_split_list(const std::string &value);
+
+// Whether the comma-separated header value list contains token, ignoring case
+bool http_has_token(const std::string &list, const std::string &token);
@@ -0,0 +1,82 @@
+#include "Resolver.h"
+
+#include <netdb.h>
+
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+// Interleaves address families, keeping the first family returned by
+// getaddrinfo (which is already sorted by RFC 6724 preference) first.
+static std::vector<Address> interleave(const std::vector<Address> &addresses) {
+    if (addresses.empty()) {
+        return addresses;
+    }
+    int first_family = addresses.front().family();
+    std::deque<Address> preferred;
+    std::deque<Address> other;
+    for (const Address &address : addresses) {
+        if (address.family() == first_family) {
+            preferred.push_back(address);
+        } else {
+            other.push_back(address);
+        }
+    }
+
+    std::vector<Address> result;
+    while (!preferred.empty() || !other.empty()) {
+        if (!preferred.empty()) {
+            result.push_back(preferred.front());
+            preferred.pop_front();
+        }
+        if (!other.empty()) {
+            result.push_back(other.front());
+            other.pop_front();
+        }
+    }
+    return result;
+}
+
+std::vector<Address> Resolver::resolve(const std::string &host, unsigned short port) {
+    std::string key = host + ":" + std::to_string(port);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            if (std::chrono::steady_clock::now() < it->second.expires) {
+                stats.hits++;
+                return it->second.addresses;
+            }
+            cache.erase(it);
+        }
+        stats.misses++;
+    }
+
+    addrinfo *query_result;
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &query_result);
+    if (status != 0) {
+        throw std::runtime_error("Error getting server address for " + host + ": "
+                + std::string(gai_strerror(status)));
+    }
+
+    std::vector<Address> addresses;
+    for (addrinfo *a = query_result; a != NULL; a = a->ai_next) {
+        Address address = {};
+        std::memcpy(&address.storage, a->ai_addr, a->ai_addrlen);
+        address.length = a->ai_addrlen;
+        addresses.push_back(address);
+    }
+    freeaddrinfo(query_result);
+    addresses = interleave(addresses);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cache[key] = Entry{addresses, std::chrono::steady_clock::now() + ttl};
+    return addresses;
+}
+
+Resolver::Stats Resolver::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A resolved address, large enough to hold either an IPv4 or IPv6 sockaddr.
+struct Address {
+    sockaddr_storage storage;
+    socklen_t length;
+
+    int family() const { return storage.ss_family; }
+    const sockaddr *get() const { return reinterpret_cast<const sockaddr*>(&storage); }
+};
+
+// getaddrinfo with a cache in front of it. Entries expire after `ttl`, since
+// getaddrinfo does not tell us the record TTLs themselves. Safe to share
+// between threads.
+class Resolver {
+ public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+ private:
+    struct Entry {
+        std::vector<Address> addresses;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    std::chrono::steady_clock::duration ttl;
+    std::mutex mutex;
+    std::map<std::string, Entry> cache;
+    Stats stats = {};
+
+ public:
+    Resolver(std::chrono::steady_clock::duration ttl = std::chrono::seconds(60)) : ttl(ttl) {}
+
+    // Returns the addresses for host in the order they should be tried, with
+    // address families interleaved as in RFC 8305 section 4.
+    std::vector<Address> resolve(const std::string &host, unsigned short port);
+
+    Stats getStats();
+};
@@ -0,0 +1,374 @@
+#include "ReverseProxy.h"
+#include "Chunked.h"
+#include "HttpResponse.h"
+#include "HttpWire.h"
+#include "Scan.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+static const size_t proxy_buffer_size = 16 * 1024;
+
+// Sends an error response in the HTTP version the client can take
+static void send_error(int fd, HttpStatus status, const HttpRequest &request) {
+    std::string response = HttpResponse::error(status, request.getVersion()).encode();
+    http_send_all(fd, response.data(), response.size());
+}
+
+// Headers describing one connection rather than the message, which must not
+// be forwarded (RFC 7230 section 6.1), including any named by Connection
+static bool is_hop_by_hop(const HttpHeader &header, const std::string &connection) {
+    static const char *const names[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+        "Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade", "Expect",
+    };
+    for (const char *name : names) {
+        if (header.hasName(name)) {
+            return true;
+        }
+    }
+    return http_has_token(connection, header.name);
+}
+
+static bool parse_length(const std::string &value, unsigned long long &length) {
+    if (value.empty() || !std::all_of(value.begin(), value.end(), ::isdigit)) {
+        return false;
+    }
+    try {
+        length = std::stoull(value);
+    } catch (const std::logic_error&) {
+        return false;
+    }
+    return true;
+}
+
+// Requests which may be sent again after a failure (RFC 7231 section 4.2.2)
+static bool is_idempotent(HttpMethod method) {
+    return method == HttpMethod::GET || method == HttpMethod::HEAD
+        || method == HttpMethod::PUT || method == HttpMethod::DELETE
+        || method == HttpMethod::OPTIONS || method == HttpMethod::TRACE;
+}
+
+void ReverseProxy::addRoute(const std::string &prefix, std::unique_ptr<UpstreamPool> pool) {
+    routes.push_back(std::make_pair(prefix, std::move(pool)));
+    std::stable_sort(routes.begin(), routes.end(),
+                     [] (const std::pair<std::string, std::unique_ptr<UpstreamPool>> &a,
+                         const std::pair<std::string, std::unique_ptr<UpstreamPool>> &b) {
+        return a.first.size() > b.first.size();
+    });
+}
+
+void ReverseProxy::addRoute(const std::string &route, BalancePolicy policy, size_t max_idle) {
+    size_t equals = route.find('=');
+    if (equals == std::string::npos || route[0] != '/') {
+        throw std::runtime_error("Invalid route " + route + ", expected /prefix=host:port,...");
+    }
+    std::vector<std::string> backends = http_split_list(route.substr(equals + 1));
+    addRoute(route.substr(0, equals),
+             std::unique_ptr<UpstreamPool>(new UpstreamPool(backends, policy, max_idle)));
+}
+
+UpstreamPool *ReverseProxy::route(const std::string &path) const {
+    for (const auto &route : routes) {
+        if (path.compare(0, route.first.size(), route.first) == 0) {
+            return route.second.get();
+        }
+    }
+    return nullptr;
+}
+
+// Sends a request body to the backend, relaying whatever the client has not
+// sent yet. Chunked bodies are forwarded verbatim, and only decoded to find
+// where they end. Returns false if the backend could not be sent to, and
+// throws std::runtime_error if the client could not supply the body.
+static bool send_request_body(int client_fd, int upstream_fd, const std::string &body_start,
+                              bool chunked, unsigned long long body_length,
+                              char *buffer, size_t buffer_size) {
+    if (!chunked) {
+        size_t body_in_start = std::min<unsigned long long>(body_length, body_start.size());
+        if (!http_send_all(upstream_fd, body_start.data(), body_in_start)) {
+            return false;
+        }
+        unsigned long long remaining = body_length - body_in_start;
+        while (remaining > 0) {
+            ssize_t bytes_received = recv(client_fd, buffer,
+                    std::min<unsigned long long>(buffer_size, remaining), 0);
+            if (bytes_received <= 0) {
+                throw std::runtime_error("Client disconnected during request body");
+            }
+            remaining -= bytes_received;
+            if (!http_send_all(upstream_fd, buffer, bytes_received)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ChunkedDecoder decoder;
+    std::string decoded;
+    const char *data = body_start.data();
+    size_t size = body_start.size();
+    while (!decoder.done()) {
+        if (size == 0) {
+            ssize_t bytes_received = recv(client_fd, buffer, buffer_size, 0);
+            if (bytes_received <= 0) {
+                throw std::runtime_error("Client disconnected during request body");
+            }
+            data = buffer;
+            size = bytes_received;
+        }
+        decoded.clear();
+        const char *consumed = decoder.decode(data, data + size, decoded);
+        if (!http_send_all(upstream_fd, data, consumed - data)) {
+            return false;
+        }
+        size -= consumed - data;
+        data = consumed;
+    }
+    return true;
+}
+
+void ReverseProxy::forward(int client_fd, const HttpRequest &request,
+                           const std::string &body_start) {
+    UpstreamPool *pool = route(request.getPath());
+    if (pool == nullptr) {
+        send_error(client_fd, HttpStatus::NotFound, request);
+        return;
+    }
+    // Request bodies need a Content-Length or chunked coding to be relayed
+    bool chunked_request = request.hasHeader("Transfer-Encoding");
+    if (request.getMethod() == HttpMethod::Unknown || request.getMethod() == HttpMethod::CONNECT
+            || (chunked_request && !chunked_is_chunked(request.getHeader("Transfer-Encoding")))) {
+        send_error(client_fd, HttpStatus::NotImplemented, request);
+        return;
+    }
+    unsigned long long body_length = 0;
+    if (!chunked_request && request.hasHeader("Content-Length")
+            && !parse_length(request.getHeader("Content-Length"), body_length)) {
+        send_error(client_fd, HttpStatus::BadRequest, request);
+        return;
+    }
+    // Without the whole body in hand, a failed request cannot be sent again
+    bool body_in_start = !chunked_request && body_length <= body_start.size();
+    bool replayable = body_in_start && is_idempotent(request.getMethod());
+
+    // The Host header is set for each backend tried
+    HttpRequest upstream_request(request.getMethod(), request.getPath(), "HTTP/1.1", "");
+    std::string connection = request.getHeader("Connection");
+    for (const HttpHeader &header : request.getHeaders()) {
+        if (!header.hasName("Host") && !is_hop_by_hop(header, connection)) {
+            upstream_request.addHeader(header);
+        }
+    }
+    if (!request.getHost().empty()) {
+        upstream_request.addHeader("X-Forwarded-Host", request.getHost());
+    }
+    if (chunked_request) {
+        upstream_request.addHeader("Transfer-Encoding", "chunked");
+    }
+    upstream_request.addHeader("Connection", "keep-alive");
+
+    // The backend is not told about Expect, so the client is told to go ahead
+    if ((chunked_request || !body_in_start)
+            && http_has_token(request.getHeader("Expect"), "100-continue")
+            && request.getVersion() == "HTTP/1.1") {
+        static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        http_send_all(client_fd, continue_response, sizeof(continue_response) - 1);
+    }
+
+    char buffer[proxy_buffer_size];
+    UpstreamPool::Lease lease;
+    std::string received;
+    size_t header_length = std::string::npos;
+    bool fresh_only = false;
+    // Whether the backend stopped taking the request body, as it may when it
+    // answers early with an error and closes
+    bool body_refused = false;
+    while (header_length == std::string::npos) {
+        if (!pool->acquire(request.getPath(), lease, fresh_only)) {
+            send_error(client_fd, HttpStatus::BadGateway, request);
+            return;
+        }
+        upstream_request.setHost(lease.backendName());
+        std::string head = upstream_request.encode();
+        bool head_sent = http_send_all(lease.fd, head.data(), head.size());
+        try {
+            body_refused = head_sent
+                && !send_request_body(client_fd, lease.fd, body_start, chunked_request,
+                                      body_length, buffer, sizeof(buffer));
+        } catch (const std::runtime_error&) {
+            pool->release(lease, UpstreamPool::Outcome::Close);
+            send_error(client_fd, HttpStatus::BadRequest, request);
+            return;
+        }
+
+        // Even if sending failed, the backend may have answered first
+        received.clear();
+        header_length = http_receive_header(lease.fd, received);
+        if (header_length != std::string::npos) {
+            break;
+        }
+        // The backend may have closed an idle connection just as it was
+        // reused, which says nothing about its health
+        if (lease.reused && received.empty() && replayable) {
+            pool->release(lease, UpstreamPool::Outcome::Close);
+            fresh_only = true;
+            continue;
+        }
+        // A backend that stops reading a body may just not want it, so only
+        // the request is failed, not the backend
+        pool->release(lease, body_refused ? UpstreamPool::Outcome::Close
+                                          : UpstreamPool::Outcome::Failed);
+        send_error(client_fd, HttpStatus::BadGateway, request);
+        return;
+    }
+
+    // Interim 1xx responses may come before the final one. 100 Continue is
+    // meant for us, since Expect is not forwarded; others, such as 103 Early
+    // Hints, are relayed to HTTP/1.1 clients and dropped for HTTP/1.0 ones,
+    // which don't expect them. 101 can't be right, as Upgrade isn't forwarded.
+    HttpResponse response;
+    int code;
+    while (true) {
+        try {
+            response = HttpResponse::consume(received.substr(0, header_length));
+        } catch (const std::runtime_error&) {
+            pool->release(lease, UpstreamPool::Outcome::Failed);
+            send_error(client_fd, HttpStatus::BadGateway, request);
+            return;
+        }
+        code = http_status_code(response.getStatusCode());
+        if (code / 100 != 1) {
+            break;
+        }
+        if (code == 101) {
+            pool->release(lease, UpstreamPool::Outcome::Failed);
+            send_error(client_fd, HttpStatus::BadGateway, request);
+            return;
+        }
+        if (code != 100 && request.getVersion() == "HTTP/1.1") {
+            HttpResponse interim(response.getStatusCode(), "HTTP/1.1");
+            connection = response.getHeader("Connection");
+            for (const HttpHeader &header : response.getHeaders()) {
+                if (!is_hop_by_hop(header, connection)) {
+                    interim.addHeader(header);
+                }
+            }
+            std::string head = interim.encodeHead();
+            http_send_all(client_fd, head.data(), head.size());
+        }
+
+        received.erase(0, header_length);
+        header_length = http_receive_header(lease.fd, received);
+        if (header_length == std::string::npos) {
+            pool->release(lease, UpstreamPool::Outcome::Failed);
+            send_error(client_fd, HttpStatus::BadGateway, request);
+            return;
+        }
+    }
+    bool chunked_response = response.hasHeader("Transfer-Encoding");
+    unsigned long long response_length = 0;
+    bool has_length = !chunked_response && response.hasHeader("Content-Length");
+    if ((chunked_response && !chunked_is_chunked(response.getHeader("Transfer-Encoding")))
+            || (has_length && !parse_length(response.getHeader("Content-Length"),
+                                            response_length))) {
+        pool->release(lease, UpstreamPool::Outcome::Failed);
+        send_error(client_fd, HttpStatus::BadGateway, request);
+        return;
+    }
+    bool no_body = request.getMethod() == HttpMethod::HEAD || code == 204 || code == 304;
+    chunked_response = chunked_response && !no_body;
+    bool until_close = !no_body && !chunked_response && !has_length;
+    bool persistent = response.getVersion() == "HTTP/1.1"
+        ? !http_has_token(response.getHeader("Connection"), "close")
+        : http_has_token(response.getHeader("Connection"), "keep-alive");
+
+    // Chunked bodies are passed through as they are to HTTP/1.1 clients,
+    // keeping any trailers, and decoded for HTTP/1.0 clients
+    bool http11_client = request.getVersion() == "HTTP/1.1";
+    bool chunked_to_client = chunked_response && http11_client;
+    HttpResponse client_response(response.getStatusCode(),
+                                 http11_client ? "HTTP/1.1" : "HTTP/1.0");
+    connection = response.getHeader("Connection");
+    for (const HttpHeader &header : response.getHeaders()) {
+        if (!is_hop_by_hop(header, connection)
+                && !(chunked_response && header.hasName("Content-Length"))) {
+            client_response.addHeader(header);
+        }
+    }
+    if (chunked_to_client) {
+        client_response.addHeader("Transfer-Encoding", "chunked");
+    }
+    client_response.addHeader("Connection", "close");
+    std::string head = client_response.encodeHead();
+    bool client_ok = http_send_all(client_fd, head.data(), head.size());
+
+    // Relay the body, starting with any part of it that arrived with the header
+    const char *data = received.data() + header_length;
+    size_t size = received.size() - header_length;
+    unsigned long long remaining = response_length;
+    bool complete = no_body || (has_length && remaining == 0);
+    bool upstream_ok = true;
+    ChunkedDecoder decoder;
+    std::string decoded;
+    while (client_ok && !complete) {
+        if (size == 0) {
+            ssize_t bytes_received = recv(lease.fd, buffer, sizeof(buffer), 0);
+            if (bytes_received == 0 && until_close) {
+                break;
+            } else if (bytes_received <= 0) {
+                upstream_ok = false;
+                break;
+            }
+            data = buffer;
+            size = bytes_received;
+        }
+
+        size_t used = size;
+        if (chunked_response) {
+            decoded.clear();
+            try {
+                used = decoder.decode(data, data + size, decoded) - data;
+            } catch (const std::runtime_error&) {
+                upstream_ok = false;
+                break;
+            }
+            complete = decoder.done();
+            client_ok = chunked_to_client
+                ? http_send_all(client_fd, data, used)
+                : http_send_all(client_fd, decoded.data(), decoded.size());
+        } else if (has_length) {
+            used = std::min<unsigned long long>(size, remaining);
+            remaining -= used;
+            complete = remaining == 0;
+            client_ok = http_send_all(client_fd, data, used);
+        } else {
+            client_ok = http_send_all(client_fd, data, used);
+        }
+        data += used;
+        size -= used;
+    }
+    if (size > 0 || body_refused) {
+        // The backend sent more than the response, or answered before taking
+        // the whole request
+        persistent = false;
+    }
+
+    // A 503 is backpressure from a backend that is working but busy, so it is
+    // given the time it asks for. 502 and 504 mean it cannot do its job.
+    if (code == 503) {
+        unsigned long long retry_after = 1;
+        parse_length(response.getHeader("Retry-After"), retry_after);
+        pool->backOff(lease, std::chrono::seconds(std::min(retry_after, 3600ull)));
+    }
+    if (!upstream_ok || code == 502 || code == 504) {
+        pool->release(lease, UpstreamPool::Outcome::Failed);
+    } else if (!client_ok || until_close || !persistent) {
+        pool->release(lease, UpstreamPool::Outcome::Close);
+    } else {
+        pool->release(lease, UpstreamPool::Outcome::Reuse);
+    }
+}
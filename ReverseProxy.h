@@ -0,0 +1,35 @@
+#pragma once
+
+#include "HttpRequest.h"
+#include "UpstreamPool.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Forwards requests whose path starts with a routed prefix to an upstream
+// pool, streaming request and response bodies through a fixed size buffer.
+// Upstream requests are sent as HTTP/1.1, so bodies may be delimited by
+// Content-Length, chunked coding or the backend closing the connection.
+class ReverseProxy {
+ private:
+    // Sorted longest prefix first, so the most specific route wins
+    std::vector<std::pair<std::string, std::unique_ptr<UpstreamPool>>> routes;
+
+ public:
+    void addRoute(const std::string &prefix, std::unique_ptr<UpstreamPool> pool);
+
+    // Parses "/prefix=host:port,host:port..." and adds the route, keeping up
+    // to max_idle idle connections per backend. Throws std::runtime_error if
+    // the route is malformed.
+    void addRoute(const std::string &route, BalancePolicy policy, size_t max_idle);
+
+    // Returns the pool for the longest prefix of path, or nullptr
+    UpstreamPool *route(const std::string &path) const;
+
+    // Forwards request, whose body starts with body_start, to its upstream
+    // pool and relays the response to client_fd. Error responses are sent if
+    // no backend can serve it. The client connection is not reusable after.
+    void forward(int client_fd, const HttpRequest &request, const std::string &body_start);
+};
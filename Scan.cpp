@@ -0,0 +1,132 @@
+#include "Scan.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static const char *scan_scalar(const char *begin, const char *end,
+        const char *needle, size_t needle_length) {
+    for (const char *p = begin; p + needle_length <= end; p++) {
+        if (*p == needle[0] && std::memcmp(p, needle, needle_length) == 0) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+// Each kernel compares a block of candidate positions against the first and
+// last bytes of the needle at once, by loading the block at offsets 0 and
+// N-1, and only checks the bytes in between for positions where both match.
+// For the CRLF-based needles that leaves almost no false candidates. Blocks
+// too close to the end to do that are left to the next narrower kernel.
+
+template<size_t N>
+__attribute__((target("sse2")))
+static const char *scan_sse2(const char *begin, const char *end, const char *needle) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[N - 1]);
+    const char *p = begin;
+    for (; end - p >= static_cast<ptrdiff_t>(16 + N - 1); p += 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + N - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                        _mm_cmpeq_epi8(block_last, last)));
+        while (mask != 0) {
+            const char *candidate = p + __builtin_ctz(mask);
+            if (N <= 2 || std::memcmp(candidate + 1, needle + 1, N - 2) == 0) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return scan_scalar(p, end, needle, N);
+}
+
+template<size_t N>
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *begin, const char *end, const char *needle) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[N - 1]);
+    const char *p = begin;
+    for (; end - p >= static_cast<ptrdiff_t>(32 + N - 1); p += 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + N - 1));
+        unsigned mask = _mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                 _mm256_cmpeq_epi8(block_last, last)));
+        while (mask != 0) {
+            const char *candidate = p + __builtin_ctz(mask);
+            if (N <= 2 || std::memcmp(candidate + 1, needle + 1, N - 2) == 0) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    // The SSE2 kernel uses the legacy encoding, which stalls while the upper
+    // halves of the ymm registers are dirty. Without this the tail costs more
+    // than the whole AVX2 loop on 1-2KB blocks and on line-by-line scans.
+    _mm256_zeroupper();
+    return scan_sse2<N>(p, end, needle);
+}
+
+// Instantiates kernel for the supported needle lengths
+#define SCAN_DISPATCH_LENGTH(kernel) \
+    switch (needle_length) { \
+        case 1: return kernel<1>(begin, end, needle); \
+        case 2: return kernel<2>(begin, end, needle); \
+        case 3: return kernel<3>(begin, end, needle); \
+        case 4: return kernel<4>(begin, end, needle); \
+        default: return scan_scalar(begin, end, needle, needle_length); \
+    }
+#endif
+
+bool scan_kernel_supported(ScanKernel kernel) {
+    switch (kernel) {
+        case ScanKernel::Scalar:
+            return true;
+#ifdef SCAN_X86
+        case ScanKernel::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case ScanKernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+// AVX2 measures fastest from 1KB header blocks up and on line-by-line scans
+// of them (see bench-scan), so the widest kernel always wins
+ScanKernel scan_kernel_selected() {
+    static const ScanKernel selected = [] {
+        if (scan_kernel_supported(ScanKernel::AVX2)) {
+            return ScanKernel::AVX2;
+        } else if (scan_kernel_supported(ScanKernel::SSE2)) {
+            return ScanKernel::SSE2;
+        }
+        return ScanKernel::Scalar;
+    }();
+    return selected;
+}
+
+const char *scan_for_with(ScanKernel kernel, const char *begin, const char *end,
+        const char *needle, size_t needle_length) {
+    switch (kernel) {
+#ifdef SCAN_X86
+        case ScanKernel::AVX2:
+            SCAN_DISPATCH_LENGTH(scan_avx2)
+        case ScanKernel::SSE2:
+            SCAN_DISPATCH_LENGTH(scan_sse2)
+#endif
+        default:
+            return scan_scalar(begin, end, needle, needle_length);
+    }
+}
+
+const char *scan_for(const char *begin, const char *end, const char *needle, size_t needle_length) {
+    return scan_for_with(scan_kernel_selected(), begin, end, needle, needle_length);
+}
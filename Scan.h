@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+// Vectorized search for short delimiters (CRLF, CRLFCRLF, ':', ' ') in
+// protocol text. The widest kernel the CPU supports (AVX2, SSE2 or plain
+// scalar code) is picked at runtime on first use.
+
+// Returns a pointer to the first occurrence of needle (1 to 4 bytes long) in
+// [begin, end), or end if there is none.
+const char *scan_for(const char *begin, const char *end, const char *needle, size_t needle_length);
+
+inline const char *scan_byte(const char *begin, const char *end, char c) {
+    return scan_for(begin, end, &c, 1);
+}
+
+inline const char *scan_crlf(const char *begin, const char *end) {
+    return scan_for(begin, end, "\r\n", 2);
+}
+
+// Finds the blank line terminating a header block
+inline const char *scan_header_end(const char *begin, const char *end) {
+    return scan_for(begin, end, "\r\n\r\n", 4);
+}
+
+// The individual kernels, exposed for benchmarking. The SIMD variants must
+// only be called if scan_kernel_supported() says so.
+enum class ScanKernel { Scalar, SSE2, AVX2 };
+
+bool scan_kernel_supported(ScanKernel kernel);
+ScanKernel scan_kernel_selected();
+const char *scan_for_with(ScanKernel kernel, const char *begin, const char *end,
+        const char *needle, size_t needle_length);
@@ -2,6 +2,8 @@
 
 #include <sys/stat.h>
 
+#include <cstdio>
+#include <ctime>
 #include <fstream>
 #include <memory>
 #include <stdexcept>
@@ -13,6 +15,23 @@ bool dirExists(const std::string &path) {
     return S_ISDIR(s.st_mode);
 }
 
+std::string httpDate(time_t time) {
+    tm t;
+    gmtime_r(&time, &t);
+    char buffer[64];
+    std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &t);
+    return buffer;
+}
+
+// Returns -1 if date is not an RFC 1123 date
+time_t parseHttpDate(const std::string &date) {
+    tm t = {};
+    if (strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &t) == nullptr) {
+        return -1;
+    }
+    return timegm(&t);
+}
+
 SimpleHttpServer::SimpleHttpServer(const std::string &hostname, short port, const std::string &root)
     : hostname(hostname), port(port), root(root) {
         if (this->root.back() != '/') {
@@ -28,16 +47,10 @@ HttpResponse SimpleHttpServer::processRequest(const HttpRequest &request) const
 
     if (request.getHost() != this->hostname
             && request.getHost() != this->hostname + ":" + std::to_string(this->port)) {
-        response.setStatusCode("400");
-        response.setVersion("HTTP/1.0");
-        response.addHeader("Connection", "close");
-        return response;
+        return HttpResponse::error(HttpStatus::BadRequest);
     }
-    if (request.getMethod() != "GET" && request.getMethod() != "HEAD") {
-        response.setStatusCode("501");
-        response.setVersion("HTTP/1.0");
-        response.addHeader("Connection", "close");
-        return response;
+    if (request.getMethod() != HttpMethod::GET && request.getMethod() != HttpMethod::HEAD) {
+        return HttpResponse::error(HttpStatus::NotImplemented);
     }
 
     std::string filename = this->root + request.getPath();
@@ -48,18 +61,60 @@ HttpResponse SimpleHttpServer::processRequest(const HttpRequest &request) const
         filename += "index.html";
     }
 
-    std::ifstream file(filename, std::ios::in | std::ios::binary);
-    if (file.is_open()) {
-        std::string file_data{std::istreambuf_iterator<char>(file),
-                              std::istreambuf_iterator<char>()};
-        response.setStatusCode("200");
-        if (request.getMethod() != "HEAD") {
-            response.setBody(file_data);
-        }
-        response.addHeader("Content-Length", std::to_string(response.getBody().size()));
-        file.close();
-    } else {
-        response.setStatusCode("404");
+    std::shared_ptr<std::ifstream> file(
+            new std::ifstream(filename, std::ios::in | std::ios::binary));
+    if (!file->is_open()) {
+        return HttpResponse::error(HttpStatus::NotFound);
+    }
+    // Validators for conditional requests. If-None-Match takes precedence over
+    // If-Modified-Since when both are present.
+    struct stat file_stat;
+    stat(filename.c_str(), &file_stat);
+    char etag[64];
+    std::snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+                  static_cast<unsigned long long>(file_stat.st_size),
+                  static_cast<unsigned long long>(file_stat.st_mtime));
+    std::string last_modified = httpDate(file_stat.st_mtime);
+
+    bool not_modified = false;
+    if (request.hasHeader("If-None-Match")) {
+        std::string if_none_match = request.getHeader("If-None-Match");
+        not_modified = if_none_match == "*" || if_none_match.find(etag) != std::string::npos;
+    } else if (request.hasHeader("If-Modified-Since")) {
+        time_t since = parseHttpDate(request.getHeader("If-Modified-Since"));
+        not_modified = since != -1 && file_stat.st_mtime <= since;
+    }
+    if (not_modified) {
+        response.setStatusCode(HttpStatus::NotModified);
+        response.setVersion("HTTP/1.0");
+        response.addHeader("ETag", etag);
+        response.addHeader("Last-Modified", last_modified);
+        response.addHeader("Connection", "close");
+        return response;
+    }
+
+    // The file is streamed rather than read up front, so the response can
+    // start before it has been read. Files that don't report their size, like
+    // pipes, are sent without a Content-Length. Files in /proc claim a size of
+    // 0 whatever they hold, so an empty file is only believed if it has
+    // nothing to read.
+    response.setStatusCode(HttpStatus::Ok);
+    if (S_ISREG(file_stat.st_mode)
+            && (file_stat.st_size > 0 || file->peek() == std::ifstream::traits_type::eof())) {
+        response.addHeader("Content-Length", std::to_string(file_stat.st_size));
+    }
+    response.addHeader("ETag", etag);
+    response.addHeader("Last-Modified", last_modified);
+    if (request.getMethod() != HttpMethod::HEAD) {
+        response.setBodyReader([file] (char *buffer, size_t size) -> ssize_t {
+            // Return whatever is available, so data from a slow pipe goes out
+            // as it arrives
+            file->read(buffer, 1);
+            if (file->gcount() == 0) {
+                return file->eof() ? 0 : -1;
+            }
+            return 1 + file->readsome(buffer + 1, size - 1);
+        });
     }
     response.setVersion("HTTP/1.0");
     response.addHeader("Connection", "close");
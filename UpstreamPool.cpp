@@ -0,0 +1,251 @@
+#include "UpstreamPool.h"
+#include "HappyEyeballs.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+// Points per backend on the hash ring, enough to spread keys evenly over a
+// handful of backends
+static const size_t ring_points_per_backend = 100;
+
+// Timeout for each send or receive on an upstream connection
+static const int upstream_io_timeout_seconds = 30;
+
+// FNV-1a, with a final avalanche step since the ring points are hashed from
+// strings that differ only in their last few characters
+static uint64_t hash_key(const std::string &key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+UpstreamPool::UpstreamPool(const std::vector<std::string> &backend_names, BalancePolicy policy,
+        size_t max_idle, Clock::duration idle_timeout,
+        unsigned max_failures, Clock::duration ejection_time)
+    : policy(policy), max_idle(max_idle), idle_timeout(idle_timeout),
+      max_failures(max_failures), ejection_time(ejection_time) {
+    if (backend_names.empty()) {
+        throw std::runtime_error("An upstream pool needs at least one backend");
+    }
+    for (const std::string &name : backend_names) {
+        size_t colon = name.rfind(':');
+        Backend backend;
+        try {
+            if (colon == std::string::npos) {
+                throw std::out_of_range("");
+            }
+            int port = std::stoi(name.substr(colon + 1));
+            if (port <= 0 || port > 65535) {
+                throw std::out_of_range("");
+            }
+            backend.port = port;
+        } catch (const std::logic_error&) {
+            throw std::runtime_error("Invalid backend " + name + ", expected host:port");
+        }
+        backend.host = name.substr(0, colon);
+        if (backend.host.size() > 2 && backend.host.front() == '['
+                && backend.host.back() == ']') {
+            backend.host = backend.host.substr(1, backend.host.size() - 2);
+        }
+        backend.name = name;
+        backends.push_back(backend);
+    }
+
+    for (size_t i = 0; i < backends.size(); i++) {
+        for (size_t point = 0; point < ring_points_per_backend; point++) {
+            ring.push_back(std::make_pair(
+                    hash_key(backends[i].name + "#" + std::to_string(point)), i));
+        }
+    }
+    std::sort(ring.begin(), ring.end());
+}
+
+UpstreamPool::~UpstreamPool() {
+    for (Backend &backend : backends) {
+        for (const IdleConnection &connection : backend.idle) {
+            close(connection.fd);
+        }
+    }
+}
+
+UpstreamPool::Backend *UpstreamPool::pick(const std::string &key,
+                                          const std::vector<Backend*> &exclude,
+                                          bool allow_busy) {
+    Clock::time_point now = Clock::now();
+    auto usable = [&] (Backend *backend) {
+        return backend->ejected_until <= now && (allow_busy || backend->busy_until <= now)
+            && std::find(exclude.begin(), exclude.end(), backend) == exclude.end();
+    };
+
+    if (policy == BalancePolicy::ConsistentHash) {
+        // Walk clockwise from the key's point to the first usable backend
+        auto start = std::lower_bound(ring.begin(), ring.end(),
+                                      std::make_pair(hash_key(key), size_t(0)));
+        size_t offset = start - ring.begin();
+        for (size_t i = 0; i < ring.size(); i++) {
+            Backend *backend = &backends[ring[(offset + i) % ring.size()].second];
+            if (usable(backend)) {
+                return backend;
+            }
+        }
+        return nullptr;
+    }
+
+    Backend *best = nullptr;
+    size_t start = next_round_robin++;
+    for (size_t i = 0; i < backends.size(); i++) {
+        Backend *backend = &backends[(start + i) % backends.size()];
+        if (usable(backend) && (best == nullptr || backend->outstanding < best->outstanding)) {
+            best = backend;
+        }
+    }
+    return best;
+}
+
+int UpstreamPool::connect(Backend *backend) {
+    int fd;
+    try {
+        fd = connect_happy_eyeballs(resolver.resolve(backend->host, backend->port));
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    if (fd == -1) {
+        return -1;
+    }
+
+    timeval timeout = {};
+    timeout.tv_sec = upstream_io_timeout_seconds;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    // Request heads and bodies are sent separately
+    int truthy = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &truthy, sizeof(truthy));
+    return fd;
+}
+
+bool UpstreamPool::acquire(const std::string &hash_key, Lease &lease, bool fresh_only) {
+    std::vector<Backend*> tried;
+    while (tried.size() < backends.size()) {
+        Backend *backend;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // Busy backends are better than none
+            backend = pick(hash_key, tried, false);
+            if (backend == nullptr) {
+                backend = pick(hash_key, tried, true);
+            }
+            if (backend == nullptr) {
+                return false;
+            }
+            backend->outstanding++;
+            closeExpired(backend);
+
+            // Prefer the most recently used idle connection, dropping ones
+            // that have been closed by the backend. An idle connection should
+            // have nothing to read.
+            while (!fresh_only && !backend->idle.empty()) {
+                IdleConnection connection = backend->idle.back();
+                backend->idle.pop_back();
+                pollfd readable = {connection.fd, POLLIN, 0};
+                if (poll(&readable, 1, 0) != 0) {
+                    close(connection.fd);
+                    continue;
+                }
+                lease.backend = backend;
+                lease.fd = connection.fd;
+                lease.reused = true;
+                return true;
+            }
+        }
+
+        int fd = connect(backend);
+        if (fd != -1) {
+            lease.backend = backend;
+            lease.fd = fd;
+            lease.reused = false;
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        backend->outstanding--;
+        recordFailure(backend);
+        tried.push_back(backend);
+    }
+    return false;
+}
+
+void UpstreamPool::release(Lease &lease, Outcome outcome) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Backend *backend = lease.backend;
+    backend->outstanding--;
+    if (outcome == Outcome::Failed) {
+        recordFailure(backend);
+    } else {
+        backend->consecutive_failures = 0;
+        backend->ejections = 0;
+    }
+
+    closeExpired(backend);
+    if (outcome == Outcome::Reuse && backend->idle.size() < max_idle) {
+        backend->idle.push_back(IdleConnection{lease.fd, Clock::now()});
+    } else {
+        close(lease.fd);
+    }
+    lease.fd = -1;
+}
+
+void UpstreamPool::backOff(const Lease &lease, Clock::duration retry_after) {
+    std::lock_guard<std::mutex> lock(mutex);
+    lease.backend->busy_until = Clock::now() + std::min(retry_after, ejection_time);
+}
+
+// Closes idle connections that have outlived idle_timeout, so they don't hold
+// backend resources until the next request. Must be called with mutex held.
+void UpstreamPool::closeExpired(Backend *backend) {
+    // Connections are idled in order, so the expired ones come first
+    Clock::time_point now = Clock::now();
+    auto fresh = backend->idle.begin();
+    while (fresh != backend->idle.end() && now - fresh->since > idle_timeout) {
+        close(fresh->fd);
+        ++fresh;
+    }
+    backend->idle.erase(backend->idle.begin(), fresh);
+}
+
+// Must be called with mutex held
+void UpstreamPool::recordFailure(Backend *backend) {
+    Clock::time_point now = Clock::now();
+    if (backend->ejected_until > now) {
+        return;
+    }
+    backend->consecutive_failures++;
+    if (backend->consecutive_failures < max_failures) {
+        return;
+    }
+
+    backend->consecutive_failures = 0;
+    backend->ejections = std::min(backend->ejections + 1, 10u);
+    Clock::duration ejected_for = ejection_time * backend->ejections;
+    backend->ejected_until = now + ejected_for;
+    for (const IdleConnection &connection : backend->idle) {
+        close(connection.fd);
+    }
+    backend->idle.clear();
+    std::cout << "Ejecting backend " << backend->name << " for "
+              << std::chrono::duration_cast<std::chrono::seconds>(ejected_for).count()
+              << "s after " << max_failures << " consecutive failures" << std::endl;
+}
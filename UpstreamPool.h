@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Resolver.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class BalancePolicy {
+    LeastOutstanding,  // Fewest requests in flight, ties broken round robin
+    ConsistentHash,    // Same hash key, same backend, while it stays healthy
+};
+
+// A set of interchangeable backend servers with a pool of idle keep-alive
+// connections to each. Safe to share between threads.
+//
+// A thread-per-connection backend, like web-server, ties up a worker for
+// each idle connection, so `max_idle` should stay well below its worker
+// count. `idle_timeout` should be shorter than the time the backend keeps an
+// idle connection open (5s for web-server), so that we close first rather
+// than reuse a connection the backend is about to close.
+//
+// Backends are health checked passively: after `max_failures` consecutive
+// failed requests a backend is ejected from balancing for `ejection_time`,
+// multiplied by the number of times it has been ejected in a row, up to ten
+// times `ejection_time`. It gets traffic again once that has elapsed.
+//
+// A backend that answers 503 is busy rather than broken. It is passed over
+// while other backends are usable, for as long as its Retry-After asks, but
+// is not ejected.
+class UpstreamPool {
+ public:
+    typedef std::chrono::steady_clock Clock;
+
+    // How a leased connection is handed back
+    enum class Outcome {
+        Reuse,   // Request succeeded and the connection can serve another
+        Close,   // The connection must not be reused, but the backend is fine
+        Failed,  // The backend failed the request
+    };
+
+ private:
+    struct IdleConnection {
+        int fd;
+        Clock::time_point since;
+    };
+
+    struct Backend {
+        std::string host;
+        unsigned short port;
+        std::string name;  // host:port, as used in Host headers and logs
+        std::vector<IdleConnection> idle;
+        size_t outstanding = 0;
+        unsigned consecutive_failures = 0;
+        unsigned ejections = 0;
+        Clock::time_point ejected_until;
+        Clock::time_point busy_until;
+    };
+
+ public:
+    struct Lease {
+        Backend *backend = nullptr;
+        int fd = -1;
+        bool reused = false;
+
+        const std::string &backendName() const { return backend->name; }
+    };
+
+ private:
+    const BalancePolicy policy;
+    const size_t max_idle;
+    const Clock::duration idle_timeout;
+    const unsigned max_failures;
+    const Clock::duration ejection_time;
+
+    Resolver resolver;
+    std::mutex mutex;
+    std::vector<Backend> backends;
+    // Consistent hash ring of (point, backend index), sorted by point
+    std::vector<std::pair<uint64_t, size_t>> ring;
+    size_t next_round_robin = 0;
+
+    Backend *pick(const std::string &hash_key, const std::vector<Backend*> &exclude,
+                  bool allow_busy);
+    int connect(Backend *backend);
+    void recordFailure(Backend *backend);
+    void closeExpired(Backend *backend);
+
+ public:
+    // backend_names are "host:port" strings, with IPv6 hosts in brackets.
+    // Throws std::runtime_error if one cannot be parsed.
+    UpstreamPool(const std::vector<std::string> &backend_names, BalancePolicy policy,
+            size_t max_idle = 2,
+            Clock::duration idle_timeout = std::chrono::seconds(4),
+            unsigned max_failures = 3,
+            Clock::duration ejection_time = std::chrono::seconds(10));
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool &operator=(const UpstreamPool&) = delete;
+
+    // Picks a healthy backend for hash_key and leases a connection to it,
+    // reusing an idle one when possible. Backends that cannot be connected to
+    // count as failed and the next one is tried. Returns false if no backend
+    // could be reached. With fresh_only, idle connections are not reused.
+    bool acquire(const std::string &hash_key, Lease &lease, bool fresh_only = false);
+
+    // Returns a leased connection, closing it unless outcome is Reuse
+    void release(Lease &lease, Outcome outcome);
+
+    // Passes over the leased connection's backend for retry_after, up to
+    // `ejection_time`, after it said it was too busy for the request
+    void backOff(const Lease &lease, Clock::duration retry_after);
+};
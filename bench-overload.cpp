@@ -0,0 +1,311 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Checks that admission control keeps goodput flat under overload. Starts
+// ./web-server with a few workers in front of an in-process backend that
+// takes a fixed time per request, so the server's capacity is known, then
+// offers open-loop load at multiples of that capacity and reports how many
+// requests were served, how many were shed and the latency of the served
+// ones.
+
+typedef std::chrono::steady_clock Clock;
+
+const int server_workers = 8;
+const std::chrono::milliseconds service_time(20);
+const std::chrono::seconds level_duration(3);
+const double load_levels[] = {0.5, 1.0, 2.0, 3.0};
+// Enough clients that the offered load is never held back by them
+const size_t client_threads = 768;
+
+int listen_loopback(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int truthy = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &truthy, sizeof(truthy));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1
+            || listen(fd, 1024) == -1) {
+        throw std::runtime_error(std::string("Failed to listen: ") + strerror(errno));
+    }
+    return fd;
+}
+
+uint16_t local_port(int fd) {
+    sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    return ntohs(address.sin_port);
+}
+
+int connect_loopback(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout = {};
+    timeout.tv_sec = 5;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The backend: one thread per connection, answering each request after
+// service_time
+void run_backend(int listen_fd) {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd == -1) {
+            continue;
+        }
+        std::thread([fd] () {
+            std::string received;
+            char buffer[4096];
+            while (received.find("\r\n\r\n") == std::string::npos) {
+                ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), 0);
+                if (bytes_received <= 0) {
+                    close(fd);
+                    return;
+                }
+                received.append(buffer, bytes_received);
+            }
+            std::this_thread::sleep_for(service_time);
+            const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n"
+                                    "Connection: close\r\n\r\nok\n";
+            send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+            close(fd);
+        }).detach();
+    }
+}
+
+// Sends one request and returns the response status, or 0 on failure
+int fetch(uint16_t port) {
+    int fd = connect_loopback(port);
+    if (fd == -1) {
+        return 0;
+    }
+    const char request[] = "GET /work HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+    std::string response;
+    char buffer[4096];
+    ssize_t bytes_received;
+    while ((bytes_received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, bytes_received);
+    }
+    close(fd);
+    int status = 0;
+    if (bytes_received < 0 || std::sscanf(response.c_str(), "HTTP/%*s %d", &status) != 1) {
+        return 0;
+    }
+    return status;
+}
+
+struct LevelResult {
+    size_t served = 0;
+    size_t shed = 0;
+    size_t failed = 0;
+    std::vector<double> latencies_ms;
+};
+
+// Offers rate requests per second for level_duration. Arrivals are scheduled
+// independently of completions, as they would be from many separate users.
+LevelResult run_level(uint16_t port, double rate) {
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::deque<Clock::time_point> arrivals;
+    bool finished = false;
+    LevelResult result;
+
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < client_threads; i++) {
+        clients.emplace_back([&] () {
+            while (true) {
+                Clock::time_point scheduled;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    arrived.wait(lock, [&] { return finished || !arrivals.empty(); });
+                    if (arrivals.empty()) {
+                        return;
+                    }
+                    scheduled = arrivals.front();
+                    arrivals.pop_front();
+                }
+                int status = fetch(port);
+                // Latency counts from the scheduled arrival, so any client
+                // side backlog is not hidden
+                double latency_ms = std::chrono::duration<double, std::milli>(
+                        Clock::now() - scheduled).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (status == 200) {
+                    result.served++;
+                    result.latencies_ms.push_back(latency_ms);
+                } else if (status == 503) {
+                    result.shed++;
+                } else {
+                    result.failed++;
+                }
+            }
+        });
+    }
+
+    Clock::time_point start = Clock::now();
+    size_t total = static_cast<size_t>(rate * level_duration.count());
+    for (size_t i = 0; i < total; i++) {
+        Clock::time_point scheduled = start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(i / rate));
+        std::this_thread::sleep_until(scheduled);
+        std::lock_guard<std::mutex> lock(mutex);
+        arrivals.push_back(scheduled);
+        arrived.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        arrived.notify_all();
+    }
+    for (std::thread &client : clients) {
+        client.join();
+    }
+    std::sort(result.latencies_ms.begin(), result.latencies_ms.end());
+    return result;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+struct Server {
+    pid_t pid;
+    std::thread output_reader;
+    std::string last_stats;  // The last "Admission:" line printed
+};
+
+// Starts ./web-server with its output on a pipe, which is read as it comes so
+// the server never blocks on it. Returns false if it does not start.
+bool start_server(Server &server, uint16_t port, const std::string &proxy_route) {
+    int output[2];
+    if (pipe(output) == -1) {
+        return false;
+    }
+    std::string workers = std::to_string(server_workers);
+    std::string port_name = std::to_string(port);
+    server.pid = fork();
+    if (server.pid == 0) {
+        dup2(output[1], STDOUT_FILENO);
+        close(output[0]);
+        close(output[1]);
+        execl("./web-server", "web-server", "127.0.0.1", port_name.c_str(), ".",
+              "--workers", workers.c_str(), "--proxy", proxy_route.c_str(), nullptr);
+        std::cerr << "Failed to start ./web-server: " << strerror(errno) << std::endl;
+        _exit(1);
+    }
+    close(output[1]);
+    server.output_reader = std::thread([&server, output] () {
+        std::string pending;
+        char buffer[4096];
+        ssize_t bytes_read;
+        while ((bytes_read = read(output[0], buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, bytes_read);
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                if (pending.compare(0, 10, "Admission:") == 0) {
+                    server.last_stats = pending.substr(0, newline);
+                }
+                pending.erase(0, newline + 1);
+            }
+        }
+        close(output[0]);
+    });
+
+    for (int attempt = 0; attempt < 50; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        int fd = connect_loopback(port);
+        if (fd != -1) {
+            close(fd);
+            return true;
+        }
+    }
+    kill(server.pid, SIGKILL);
+    waitpid(server.pid, nullptr, 0);
+    server.output_reader.join();
+    return false;
+}
+
+// Stops the server, which prints its admission stats as it goes
+void stop_server(Server &server) {
+    kill(server.pid, SIGTERM);
+    waitpid(server.pid, nullptr, 0);
+    server.output_reader.join();
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+
+    int backend_fd = listen_loopback(0);
+    std::thread(run_backend, backend_fd).detach();
+    std::string proxy_route = "/=127.0.0.1:" + std::to_string(local_port(backend_fd));
+
+    double capacity = server_workers * 1000.0 / service_time.count();
+    std::cout << "Capacity: " << server_workers << " workers, "
+              << service_time.count() << "ms per request = " << capacity << " requests/s"
+              << std::endl << std::endl;
+    std::printf("%8s %10s %10s %10s %10s %10s %10s %10s\n", "load", "offered/s", "goodput/s",
+                "delay/s", "limit/s", "failed/s", "p50 ms", "p99 ms");
+    for (double level : load_levels) {
+        // A fresh server for each level, so that its stats are for the level
+        // alone. Pick a free port for it.
+        int probe_fd = listen_loopback(0);
+        uint16_t port = local_port(probe_fd);
+        close(probe_fd);
+        Server server;
+        if (!start_server(server, port, proxy_route)) {
+            std::cerr << "web-server did not start" << std::endl;
+            return 1;
+        }
+        LevelResult result = run_level(port, level * capacity);
+        stop_server(server);
+
+        // Both kinds of shedding get the same 503, so the server says which
+        unsigned long long shed_overflow = 0;
+        unsigned long long shed_delay = 0;
+        std::sscanf(server.last_stats.c_str(),
+                    "Admission: %*u admitted, %*u served, %*u failed, "
+                    "%llu shed (connection limit), %llu shed (queue delay)",
+                    &shed_overflow, &shed_delay);
+        double seconds = level_duration.count();
+        std::printf("%7.1fx %10.0f %10.0f %10.0f %10.0f %10.0f %10.1f %10.1f\n",
+                    level, level * capacity, result.served / seconds, shed_delay / seconds,
+                    shed_overflow / seconds, result.failed / seconds,
+                    percentile(result.latencies_ms, 0.5), percentile(result.latencies_ms, 0.99));
+    }
+    std::cout << std::endl << "delay/s and limit/s are 503s for queueing delay and for the "
+              << "--max-connections limit" << std::endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "HttpRequest.h"
+#include "Scan.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Benchmarks the delimiter scanning kernels on realistic request header
+// blocks of roughly 1 to 8 KB, comparing them with std::string::find and
+// timing a full HttpRequest::consume.
+
+std::string make_header_block(size_t target_size) {
+    static const char *const common_headers[] = {
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+            "Chrome/120.0.0.0 Safari/537.36",
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,"
+            "image/webp,*/*;q=0.8",
+        "Accept-Language: en-GB,en;q=0.9",
+        "Accept-Encoding: gzip, deflate",
+        "Connection: close",
+        "Referer: http://localhost/articles/2018/01/index.html",
+        "Cache-Control: max-age=0",
+    };
+    std::string block = "GET /articles/2018/01/some-long-article-name.html HTTP/1.0\r\n"
+                        "Host: localhost\r\n";
+    for (const char *header : common_headers) {
+        block += header;
+        block += "\r\n";
+    }
+    // Pad out with cookies, as real large header blocks usually are
+    for (int i = 0; block.size() + 4 < target_size; i++) {
+        block += "Cookie: session_" + std::to_string(i) + "=";
+        block += std::string(64, 'a' + i % 26);
+        block += "\r\n";
+    }
+    block += "\r\n";
+    return block;
+}
+
+template<typename F>
+double time_per_iteration_ns(F f, size_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        f();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main() {
+    const size_t iterations = 200000;
+    const struct {
+        ScanKernel kernel;
+        const char *name;
+    } kernels[] = {
+        {ScanKernel::Scalar, "scalar"},
+        {ScanKernel::SSE2, "sse2"},
+        {ScanKernel::AVX2, "avx2"},
+    };
+
+    std::cout << "Selected kernel: " << static_cast<int>(scan_kernel_selected()) << std::endl;
+    for (size_t size : {1024, 2048, 4096, 8192}) {
+        std::string block = make_header_block(size);
+        const char *begin = block.data();
+        const char *end = begin + block.size();
+        std::cout << block.size() << " byte header block" << std::endl;
+
+        volatile size_t sink = 0;
+        for (const auto &k : kernels) {
+            if (!scan_kernel_supported(k.kernel)) {
+                continue;
+            }
+            double header_end_ns = time_per_iteration_ns([&] {
+                sink = sink + (scan_for_with(k.kernel, begin, end, "\r\n\r\n", 4) - begin);
+            }, iterations);
+            double lines_ns = time_per_iteration_ns([&] {
+                for (const char *p = begin; p < end; p += 2) {
+                    p = scan_for_with(k.kernel, p, end, "\r\n", 2);
+                    sink = sink + 1;
+                }
+            }, iterations);
+            std::cout << "  " << k.name << ": CRLFCRLF " << header_end_ns << " ns ("
+                      << block.size() / header_end_ns << " GB/s), all CRLFs "
+                      << lines_ns << " ns" << std::endl;
+        }
+
+        double find_ns = time_per_iteration_ns([&] {
+            sink = sink + block.find("\r\n\r\n");
+        }, iterations);
+        std::cout << "  std::string::find: CRLFCRLF " << find_ns << " ns" << std::endl;
+
+        double consume_ns = time_per_iteration_ns([&] {
+            sink = sink + HttpRequest::consume(block).getPath().size();
+        }, iterations / 20);
+        std::cout << "  HttpRequest::consume: " << consume_ns << " ns" << std::endl;
+    }
+}
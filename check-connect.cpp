@@ -0,0 +1,207 @@
+#include "HappyEyeballs.h"
+#include "Resolver.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Checks the resolver cache and Happy Eyeballs connection racing against
+// local sockets: cache expiry, falling back to the next address after the
+// attempt delay when the first one hangs, and giving up when every attempt
+// fails. Exits non-zero if any check fails.
+
+typedef std::chrono::steady_clock Clock;
+
+int failures = 0;
+
+void check(bool passed, const std::string &description) {
+    std::cout << (passed ? "PASS " : "FAIL ") << description << std::endl;
+    if (!passed) {
+        failures++;
+    }
+}
+
+long elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+Address loopback_address(uint16_t port) {
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    Address result = {};
+    std::memcpy(&result.storage, &address, sizeof(address));
+    result.length = sizeof(address);
+    return result;
+}
+
+uint16_t port_of(int fd) {
+    sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    return ntohs(address.sin_port);
+}
+
+// A loopback listener on an ephemeral port
+int listen_loopback(int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    Address address = loopback_address(0);
+    bind(fd, address.get(), address.length);
+    listen(fd, backlog);
+    return fd;
+}
+
+// A port with nothing listening on it, so connecting is refused at once
+uint16_t closed_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    Address address = loopback_address(0);
+    bind(fd, address.get(), address.length);
+    uint16_t port = port_of(fd);
+    close(fd);
+    return port;
+}
+
+// A listener that is never accepted from and whose accept queue is full, so
+// further SYNs are dropped and connecting to it hangs. The connections that
+// fill the queue are added to `held`.
+int hanging_listener(std::vector<int> &held) {
+    int fd = listen_loopback(0);
+    Address address = loopback_address(port_of(fd));
+    for (int i = 0; i < 4; i++) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        connect(sock, address.get(), address.length);
+        held.push_back(sock);
+    }
+    // Let the handshakes that will complete do so
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return fd;
+}
+
+void check_resolver_cache() {
+    Resolver resolver(std::chrono::milliseconds(200));
+    std::vector<Address> addresses = resolver.resolve("localhost", 80);
+    check(!addresses.empty(), "localhost resolves");
+    resolver.resolve("localhost", 80);
+    Resolver::Stats stats = resolver.getStats();
+    check(stats.misses == 1 && stats.hits == 1, "second lookup within the TTL is a cache hit");
+    resolver.resolve("localhost", 81);
+    stats = resolver.getStats();
+    check(stats.misses == 2, "the cache is keyed by port as well as host");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    resolver.resolve("localhost", 80);
+    stats = resolver.getStats();
+    check(stats.misses == 3 && stats.hits == 1, "lookup after the TTL expires misses the cache");
+}
+
+void check_fallback() {
+    std::vector<int> held;
+    int hanging = hanging_listener(held);
+    int listening = listen_loopback(16);
+    std::vector<Address> addresses = {loopback_address(port_of(hanging)),
+                                      loopback_address(port_of(listening))};
+
+    Clock::time_point start = Clock::now();
+    int fd = connect_happy_eyeballs(addresses);
+    long elapsed = elapsed_ms(start);
+    sockaddr_in peer = {};
+    socklen_t length = sizeof(peer);
+    bool connected_second = fd != -1
+        && getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &length) == 0
+        && ntohs(peer.sin_port) == port_of(listening);
+    check(connected_second, "falls back to the second address when the first hangs");
+    check(elapsed >= 240 && elapsed < 1000,
+          "second attempt starts after the 250ms attempt delay (took "
+          + std::to_string(elapsed) + "ms)");
+    check(fd != -1 && (fcntl(fd, F_GETFL) & O_NONBLOCK) == 0, "returned socket is blocking");
+    if (fd != -1) {
+        close(fd);
+    }
+
+    // A refused first attempt should not hold up the second one
+    addresses[0] = loopback_address(closed_port());
+    start = Clock::now();
+    fd = connect_happy_eyeballs(addresses);
+    elapsed = elapsed_ms(start);
+    check(fd != -1 && elapsed < 100, "a refused attempt starts the next one at once (took "
+          + std::to_string(elapsed) + "ms)");
+    if (fd != -1) {
+        close(fd);
+    }
+
+    // Nor should one that fails before it gets going, while an earlier one is
+    // still in progress. A made-up address family makes socket() fail.
+    Address unusable = {};
+    unusable.storage.ss_family = AF_MAX;
+    unusable.length = sizeof(unusable.storage);
+    addresses = {loopback_address(port_of(hanging)), unusable,
+                 loopback_address(port_of(listening))};
+    start = Clock::now();
+    fd = connect_happy_eyeballs(addresses);
+    elapsed = elapsed_ms(start);
+    check(fd != -1 && elapsed >= 240 && elapsed < 400,
+          "an attempt failing at once starts the next one at once (took "
+          + std::to_string(elapsed) + "ms)");
+    if (fd != -1) {
+        close(fd);
+    }
+
+    close(listening);
+    close(hanging);
+    for (int sock : held) {
+        close(sock);
+    }
+}
+
+void check_all_fail() {
+    std::vector<Address> refused = {loopback_address(closed_port()),
+                                    loopback_address(closed_port())};
+    Clock::time_point start = Clock::now();
+    int fd = connect_happy_eyeballs(refused);
+    long elapsed = elapsed_ms(start);
+    check(fd == -1 && elapsed < 100, "gives up at once when every address is refused (took "
+          + std::to_string(elapsed) + "ms)");
+
+    std::vector<int> held;
+    int first = hanging_listener(held);
+    int second = hanging_listener(held);
+    std::vector<Address> hanging = {loopback_address(port_of(first)),
+                                    loopback_address(port_of(second))};
+    start = Clock::now();
+    fd = connect_happy_eyeballs(hanging, std::chrono::milliseconds(250),
+                                std::chrono::milliseconds(600));
+    elapsed = elapsed_ms(start);
+    check(fd == -1 && elapsed >= 590 && elapsed < 1000,
+          "gives up at the timeout when every address hangs (took "
+          + std::to_string(elapsed) + "ms)");
+    close(first);
+    close(second);
+    for (int sock : held) {
+        close(sock);
+    }
+
+    check(connect_happy_eyeballs(std::vector<Address>()) == -1, "no addresses gives -1");
+}
+
+int main() {
+    check_resolver_cache();
+    check_fallback();
+    check_all_fail();
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "Scan.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+
+// Checks every delimiter scanning kernel the CPU supports against the scalar
+// one, on random protocol-like text of every length up to a few blocks and at
+// every alignment, for each needle length. Exits non-zero on any mismatch.
+
+int failures = 0;
+
+void check(bool passed, const std::string &description) {
+    std::cout << (passed ? "PASS " : "FAIL ") << description << std::endl;
+    if (!passed) {
+        failures++;
+    }
+}
+
+// Text mostly made of the needles' own bytes, so matches, near misses and
+// matches straddling block boundaries are all common
+std::string random_text(std::mt19937 &random, size_t length) {
+    static const char alphabet[] = "\r\n\r\n\r\n: a";
+    std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+    std::string text(length, ' ');
+    for (char &c : text) {
+        c = alphabet[pick(random)];
+    }
+    return text;
+}
+
+size_t mismatches(ScanKernel kernel, const char *needle, size_t needle_length) {
+    std::mt19937 random(1);
+    size_t mismatched = 0;
+    for (size_t length = 0; length <= 200; length++) {
+        for (int round = 0; round < 20; round++) {
+            std::string text = random_text(random, length + 32);
+            for (size_t offset = 0; offset < 32; offset++) {
+                const char *begin = text.data() + offset;
+                const char *end = begin + length;
+                if (scan_for_with(kernel, begin, end, needle, needle_length)
+                        != scan_for_with(ScanKernel::Scalar, begin, end, needle, needle_length)) {
+                    mismatched++;
+                }
+            }
+        }
+    }
+    return mismatched;
+}
+
+int main() {
+    const struct {
+        ScanKernel kernel;
+        const char *name;
+    } kernels[] = {
+        {ScanKernel::SSE2, "sse2"},
+        {ScanKernel::AVX2, "avx2"},
+    };
+    const char *const needles[] = {":", "\r\n", "\r\n\r", "\r\n\r\n", "\n: "};
+
+    for (const auto &k : kernels) {
+        if (!scan_kernel_supported(k.kernel)) {
+            std::cout << "SKIP " << k.name << " is not supported" << std::endl;
+            continue;
+        }
+        for (const char *needle : needles) {
+            std::string needle_string(needle);
+            size_t mismatched = mismatches(k.kernel, needle, needle_string.size());
+            std::string shown;
+            for (char c : needle_string) {
+                shown += c == '\r' ? "\\r" : c == '\n' ? "\\n" : std::string(1, c);
+            }
+            check(mismatched == 0, std::string(k.name) + " matches scalar for \"" + shown
+                  + "\" (" + std::to_string(mismatched) + " mismatches)");
+        }
+    }
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
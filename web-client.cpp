@@ -1,21 +1,45 @@
+#include "Chunked.h"
+#include "DiskCache.h"
+#include "HappyEyeballs.h"
+#include "Http2ClientConnection.h"
 #include "HttpRequest.h"
 #include "HttpResponse.h"
+#include "HttpWire.h"
+#include "Resolver.h"
+#include "Scan.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netdb.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <regex>
 #include <string>
-#include <sstream>
+#include <vector>
 
-void download_file(const std::string &url) {
+// State shared by all the downloads in a run
+struct DownloadContext {
+    Resolver resolver;
+    DiskCache *cache = nullptr; // Disabled unless --cache-dir is given
+    int revalidated = 0;
+    long long bytes_saved = 0;
+};
+
+struct Url {
+    std::string host;
+    unsigned short port;
+    std::string path;
+
+    std::string cacheKey() const { return host + ":" + std::to_string(port) + path; }
+};
+
+bool parse_url(const std::string &url, Url &result) {
     const static std::regex ulr_pattern(
                 std::string("^(?:http:\\/\\/)?(\\[[a-f0-9:]+|[a-z0-9-._~%]+)")
                 + "(?:\\:(\\d{1,5}))?(?:(\\/[\\/a-z0-9-._~%]*(?:\\?[\\/a-z0-9-=._~%]*)?)"
@@ -27,7 +51,7 @@ void download_file(const std::string &url) {
     std::regex_match(url, url_match, ulr_pattern);
     if (url_match.size() < 2) {
         std::cerr << "Invalid url " << url << std::endl;
-        return;
+        return false;
     }
     std::string host = url_match[1];
     unsigned short port;
@@ -40,7 +64,7 @@ void download_file(const std::string &url) {
         } catch (const std::logic_error&) {
             std::cerr << "port must be an integer between 0 and 65535, found "
                 << url_match[2] << std::endl;
-            return;
+            return false;
         }
     } else {
         port = 80;
@@ -52,108 +76,194 @@ void download_file(const std::string &url) {
         path = "/";
     }
 
-    // Get server address
-    addrinfo *address;
-    addrinfo hints = {};
-    hints.ai_socktype = SOCK_STREAM;
-    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &address);
-    if (status != 0) {
-        std::cerr << "Error getting server address for " << host << ": "
-            << gai_strerror(status) << std::endl;
-        return;
+    result.host = host;
+    result.port = port;
+    result.path = path;
+    return true;
+}
+
+int connect_to_host(DownloadContext &context, const Url &url) {
+    // Get server addresses
+    std::vector<Address> addresses;
+    try {
+        addresses = context.resolver.resolve(url.host, url.port);
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
     }
 
-    // Connect to server
-    int sock = socket(address->ai_family, SOCK_STREAM, 0);
-    if (connect(sock, address->ai_addr, address->ai_addrlen) == -1) {
-        std::cerr << "Error connecting to host " << host << std::endl;
-        return;
+    // Connect to server, racing all of its addresses
+    int sock = connect_happy_eyeballs(addresses);
+    if (sock == -1) {
+        std::cerr << "Error connecting to host " << url.host << std::endl;
     }
+    return sock;
+}
 
-    // Send request
-    HttpRequest request("GET", path, "HTTP/1.0", host);
+HttpRequest make_request(DownloadContext &context, const Url &url,
+                         DiskCache::Entry &cache_entry, bool &cached) {
+    // HTTP/1.1, so that servers can stream bodies of unknown length chunked
+    HttpRequest request(HttpMethod::GET, url.path, "HTTP/1.1", url.host);
     request.addHeader("Connection", "close");
-    std::string request_str = request.encode();
-    send(sock, request_str.c_str(), request_str.size(), 0);
-    std::cout << "Sent request for " << path << " to "  << host
-        << " on port " << port << std::endl;
 
-    // Receive response
-    std::stringstream ss;
-    const size_t buffer_size = 256;
+    // Ask the server to skip the body if our cached copy is still current
+    cached = context.cache != nullptr && context.cache->lookup(url.cacheKey(), cache_entry);
+    if (cached) {
+        if (!cache_entry.etag.empty()) {
+            request.addHeader("If-None-Match", cache_entry.etag);
+        }
+        if (!cache_entry.last_modified.empty()) {
+            request.addHeader("If-Modified-Since", cache_entry.last_modified);
+        }
+    }
+    return request;
+}
+
+// Writes the body of response to body_file as it arrives, so memory use stays
+// bounded whatever its size. body_start is the part received with the header.
+// Trailers of chunked bodies are added to the response headers where allowed.
+bool receive_body(int sock, const std::string &host, HttpResponse &response,
+                  const std::string &body_start, const std::string &body_file) {
+    std::ofstream file(body_file, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.good()) {
+        std::cerr << "Error opening file for writing: " << body_file << std::endl;
+        return false;
+    }
+
+    // The body is chunked, delimited by Content-Length, or ends when the
+    // server closes the connection
+    bool chunked = response.hasHeader("Transfer-Encoding");
+    if (chunked && !chunked_is_chunked(response.getHeader("Transfer-Encoding"))) {
+        std::cerr << "Unsupported transfer coding from " << host << ": "
+            << response.getHeader("Transfer-Encoding") << std::endl;
+        return false;
+    }
+    long long remaining = -1;
+    if (!chunked && response.hasHeader("Content-Length")) {
+        try {
+            remaining = std::stoll(response.getHeader("Content-Length"));
+        } catch (const std::logic_error &e) {
+            std::cerr << "Malformed response from " << host
+                << ", error parsing Content-Length value: "
+                << e.what() << std::endl;
+            remaining = -1; // Continue without Content-Length
+        }
+    }
+
+    ChunkedDecoder decoder;
+    std::string decoded;
+    const size_t buffer_size = 16 * 1024;
     char buffer[buffer_size];
-    size_t header_length = std::string::npos;
-    size_t body_length = std::string::npos;
-    size_t total_bytes_received = 0;
-    do {
-        ssize_t bytes_received = recv(sock, buffer, buffer_size, 0);
-        if (bytes_received < 0) {
-            std::cerr << "Connection error" << std::endl;
-            return;
-        } else if (bytes_received == 0) { // Connection closed
-            if (body_length != std::string::npos
-                    && total_bytes_received < header_length + body_length) {
-                std::cerr << "Server " << host <<
-                    " closed connection before full message was recieved.";
-            }
-            break;
-        } else {
-            total_bytes_received += bytes_received;
-            ss.write(buffer, bytes_received);
-        }
-
-        // See if the Content-Length can be extracted from the header
-        if (header_length == std::string::npos) { // If we haven't done so already
-            std::string partial_message = ss.str();
-            // Only if we have received the full header
-            if ((header_length = partial_message.find("\r\n\r\n")) != std::string::npos) {
-                header_length += 4; // Account for the \r\n\r\n
-
-                HttpResponse partial_response;
-                try {
-                    partial_response = HttpResponse::consume(partial_message);
-                } catch (const std::runtime_error &e) {
-                    std::cerr << "Error: " << e.what() << std::endl;
+    const char *data = body_start.data();
+    size_t size = body_start.size();
+    while (chunked ? !decoder.done() : remaining != 0) {
+        if (size == 0) {
+            ssize_t bytes_received = recv(sock, buffer, buffer_size, 0);
+            if (bytes_received < 0) {
+                std::cerr << "Connection error" << std::endl;
+                return false;
+            } else if (bytes_received == 0) { // Connection closed
+                if (chunked || remaining > 0) {
+                    std::cerr << "Server " << host
+                        << " closed connection before full message was received." << std::endl;
+                    return false;
                 }
+                break;
+            }
+            data = buffer;
+            size = bytes_received;
+        }
 
-                if (partial_response.hasHeader("Content-Length")) {
-                    try {
-                        body_length = std::stoll(partial_response.getHeader("Content-Length"));
-                    } catch (const std::logic_error &e) {
-                        std::cerr << "Malformed response from " << host
-                            << ", error parsing Content-Length value: "
-                            << e.what() << std::endl;
-                        body_length = std::string::npos; // Continue without Content-Length
-                    }
-                }
+        if (chunked) {
+            decoded.clear();
+            try {
+                decoder.decode(data, data + size, decoded);
+            } catch (const std::runtime_error &e) {
+                std::cerr << "Malformed chunked body from " << host << ": " << e.what()
+                    << std::endl;
+                return false;
+            }
+            file.write(decoded.data(), decoded.size());
+        } else {
+            size_t length = remaining < 0 ? size : std::min<long long>(size, remaining);
+            file.write(data, length);
+            if (remaining > 0) {
+                remaining -= length;
             }
         }
+        size = 0;
+    }
 
-        // Do not wait for the server to close the connection if the entire message has been
-        // recieved
-        if (body_length != std::string::npos
-                && header_length + body_length <= total_bytes_received) {
-            break;
+    for (const HttpHeader &trailer : decoder.getTrailers()) {
+        if (chunked_trailer_allowed(trailer)) {
+            response.addHeader(trailer);
         }
-    } while (true);
+    }
+    file.close();
+    if (!file.good()) {
+        std::cerr << "Error writing file " << body_file << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    close(sock);
+std::string response_filename(const std::string &path);
+void save_response(DownloadContext &context, const Url &url, const HttpResponse &response,
+                   const std::string &body_file, bool cached, DiskCache::Entry &cache_entry);
 
+void download_file(DownloadContext &context, const std::string &url_string) {
+    Url url;
+    if (!parse_url(url_string, url)) {
+        return;
+    }
+    const std::string &host = url.host;
+    int sock = connect_to_host(context, url);
+    if (sock == -1) {
+        return;
+    }
+
+    // Send request
+    DiskCache::Entry cache_entry;
+    bool cached;
+    HttpRequest request = make_request(context, url, cache_entry, cached);
+    std::string request_str = request.encode();
+    send(sock, request_str.c_str(), request_str.size(), 0);
+    std::cout << "Sent request for " << url.path << " to "  << host
+        << " on port " << url.port << std::endl;
+
+    // Receive response header
+    std::string received;
+    size_t header_length = http_receive_header(sock, received);
+    if (header_length == std::string::npos) {
+        std::cerr << "Server " << host << " closed connection before sending a response"
+            << std::endl;
+        close(sock);
+        return;
+    }
     HttpResponse response;
     try {
-        response = HttpResponse::consume(ss.str());
+        response = HttpResponse::consume(received.substr(0, header_length));
     } catch (const std::runtime_error &e) {
         std::cerr << "Error: " << e.what() << std::endl;
+        close(sock);
         return;
     }
-    if (response.getStatusCode() == "200") {
-        std::cerr << "Request successful. Status code: 200" << std::endl;
-    } else {
-        std::cerr << "Request unsuccessful. Status code: " << response.getStatusCode()
-            << std::endl;
-        return;
+
+    // Only the bodies of successful responses are kept
+    std::string body_file;
+    if (response.getStatusCode() == HttpStatus::Ok) {
+        body_file = "./" + response_filename(url.path) + ".part";
+        if (!receive_body(sock, host, response, received.substr(header_length), body_file)) {
+            unlink(body_file.c_str());
+            close(sock);
+            return;
+        }
     }
+    close(sock);
+    save_response(context, url, response, body_file, cached, cache_entry);
+}
 
+std::string response_filename(const std::string &path) {
     // Extract filename using regular expressions
     const static std::regex path_pattern(std::string("^(?:[\\/a-z0-9-._~%])*?([a-z0-9-._~%]*)")
             + "(?:\\?[\\/a-z0-9-.=_~%]*)?$",
@@ -167,23 +277,166 @@ void download_file(const std::string &url) {
     if (filename == "") { // if failed matching, or filename empty, use default
         filename = "index.html";
     }
+    return filename;
+}
 
-    std::ofstream file("./" + filename, std::ios::out | std::ios::trunc);
-    if (!file.good()) {
-        std::cerr << "Error opening file for writing: " << filename << std::endl;
+// Puts body_file, the downloaded body of a 200 response, in place, or the
+// cached copy for a 304 response
+void save_response(DownloadContext &context, const Url &url, const HttpResponse &response,
+                   const std::string &body_file, bool cached, DiskCache::Entry &cache_entry) {
+    const std::string &path = url.path;
+    const std::string cache_key = url.cacheKey();
+    bool not_modified = cached && response.getStatusCode() == HttpStatus::NotModified;
+    if (response.getStatusCode() == HttpStatus::Ok) {
+        std::cerr << "Request successful. Status code: 200" << std::endl;
+    } else if (not_modified) {
+        std::cerr << "Cached copy is up to date. Status code: 304" << std::endl;
+    } else {
+        std::cerr << "Request unsuccessful. Status code: "
+            << http_status_code(response.getStatusCode()) << std::endl;
+        return;
+    }
+
+    std::string filename = response_filename(path);
+
+    // Reuse the cached body if it is current, otherwise cache the new one, then
+    // move the download into place
+    if (not_modified) {
+        context.cache->refresh(cache_key, response, cache_entry);
+        if (DiskCache::isCopyOf(cache_entry, "./" + filename)
+                || DiskCache::materialize(cache_entry.body_path, "./" + filename)) {
+            context.revalidated++;
+            context.bytes_saved += cache_entry.content_length;
+            std::cerr << "Success reusing cached file " << filename << std::endl;
+            return;
+        }
+        std::cerr << "Error copying cached file to " << filename << std::endl;
+        return;
+    }
+    if (context.cache != nullptr
+            && context.cache->store(cache_key, response, body_file, cache_entry)
+            && std::rename(body_file.c_str(), ("./" + filename).c_str()) == 0) {
+        std::cerr << "Success downloading file " << filename << std::endl;
+        return;
+    }
+
+    if (std::rename(body_file.c_str(), ("./" + filename).c_str()) != 0) {
+        unlink(body_file.c_str());
+        std::cerr << "Error writing file " << filename << std::endl;
+        return;
     }
-    file << response.getBody();
-    file.flush();
-    file.close();
     std::cerr << "Success downloading file " << filename << std::endl;
 }
 
+// Downloads urls over one h2c connection per server, instead of one HTTP/1.0
+// connection per url
+void download_files_h2(DownloadContext &context, const std::vector<std::string> &url_strings) {
+    // Group urls by server, keeping the order each server first appears in
+    std::vector<std::vector<Url>> groups;
+    for (const std::string &url_string : url_strings) {
+        Url url;
+        if (!parse_url(url_string, url)) {
+            continue;
+        }
+        auto group = std::find_if(groups.begin(), groups.end(),
+                                  [&url] (const std::vector<Url> &g) {
+            return g.front().host == url.host && g.front().port == url.port;
+        });
+        if (group == groups.end()) {
+            groups.push_back(std::vector<Url>(1, url));
+        } else {
+            group->push_back(url);
+        }
+    }
+
+    for (const std::vector<Url> &urls : groups) {
+        int sock = connect_to_host(context, urls.front());
+        if (sock == -1) {
+            continue;
+        }
+
+        std::vector<HttpRequest> requests;
+        std::vector<DiskCache::Entry> cache_entries(urls.size());
+        std::vector<bool> cached(urls.size());
+        for (size_t i = 0; i < urls.size(); i++) {
+            bool is_cached;
+            requests.push_back(make_request(context, urls[i], cache_entries[i], is_cached));
+            cached[i] = is_cached;
+        }
+        std::cout << "Sending " << requests.size() << " requests to " << urls.front().host
+            << " on port " << urls.front().port << " over HTTP/2" << std::endl;
+        std::vector<Http2ClientConnection::Result> results =
+            Http2ClientConnection(sock).fetch(requests);
+        close(sock);
+
+        for (size_t i = 0; i < urls.size(); i++) {
+            std::cerr << std::endl << "Response for " << urls[i].path << std::endl;
+            if (!results[i].error.empty()) {
+                std::cerr << "Error: " << results[i].error << std::endl;
+                continue;
+            }
+            // Bodies arrive whole over HTTP/2, so are just written out
+            const HttpResponse &response = results[i].response;
+            std::string body_file;
+            if (response.getStatusCode() == HttpStatus::Ok) {
+                body_file = "./" + response_filename(urls[i].path) + ".part";
+                std::ofstream file(body_file, std::ios::out | std::ios::trunc | std::ios::binary);
+                std::string body = response.getBody();
+                file.write(body.data(), body.size());
+                file.close();
+                if (!file.good()) {
+                    std::cerr << "Error writing file " << body_file << std::endl;
+                    unlink(body_file.c_str());
+                    continue;
+                }
+            }
+            save_response(context, urls[i], response, body_file, cached[i], cache_entries[i]);
+        }
+    }
+}
+
+void print_usage() {
+    std::cerr << "Usage: web-client [--cache-dir dir] [--h2] url..." << std::endl;
+}
+
 int main(int argc, char **argv) {
-    for (int address_index = 1; address_index < argc; address_index++) {
-        download_file(argv[address_index]);
+    DownloadContext context;
+    std::unique_ptr<DiskCache> cache;
+    std::vector<std::string> urls;
+    bool use_h2 = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--h2") {
+            use_h2 = true;
+        } else if (std::string(argv[i]) == "--cache-dir") {
+            if (i + 1 >= argc) {
+                print_usage();
+                return 1;
+            }
+            try {
+                cache.reset(new DiskCache(argv[++i]));
+            } catch (const std::runtime_error &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            context.cache = cache.get();
+        } else {
+            urls.push_back(argv[i]);
+        }
+    }
+
+    if (use_h2) {
+        download_files_h2(context, urls);
+    }
+    for (size_t url_index = 0; url_index < urls.size() && !use_h2; url_index++) {
+        download_file(context, urls[url_index]);
 
-        if (address_index != argc - 1) { // Insert a newline between requests
+        if (url_index != urls.size() - 1) { // Insert a newline between requests
             std::cerr << std::endl;
         }
     }
+
+    if (context.cache != nullptr) {
+        std::cerr << std::endl << "Cache: " << context.revalidated << " of " << urls.size()
+            << " files revalidated, " << context.bytes_saved << " bytes saved" << std::endl;
+    }
 }
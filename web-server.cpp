@@ -1,5 +1,11 @@
+#include "AdmissionController.h"
+#include "Chunked.h"
 #include "HttpRequest.h"
+#include "Http2ServerConnection.h"
 #include "HttpResponse.h"
+#include "HttpWire.h"
+#include "ReverseProxy.h"
+#include "Scan.h"
 #include "SimpleHttpServer.h"
 
 
@@ -8,30 +14,107 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
-#include <future>
+#include <deque>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 std::vector<sockaddr> get_ip_address(const std::string &hostname, const unsigned short port);
 std::string ip_to_string(const sockaddr &address);
+void handle_connection(const SimpleHttpServer &server, ReverseProxy &proxy, int fd,
+                       size_t max_streams);
+void shed_connection(int fd);
+void close_lingering();
+void print_admission_stats(const AdmissionController::Stats &stats);
 void print_usage();
 
+// Set by SIGINT and SIGTERM, to stop after printing the admission stats
+volatile sig_atomic_t stop_requested = 0;
+
 int main(int argc, char **argv) {
     if (argc < 4) {
         print_usage();
         return 1;
     }
 
+    // Admission control defaults, overridable with --backlog, --max-connections
+    // and --workers, and the HTTP/2 stream limit per connection, --max-streams
+    int backlog = 128;
+    size_t max_connections = 256;
+    size_t workers = std::max(4u, 4 * std::thread::hardware_concurrency());
+    size_t max_streams = 100;
+    // Reverse proxy routes, how their backends are chosen, and how many idle
+    // connections to keep to each backend, --upstream-idle
+    std::vector<std::string> proxy_routes;
+    BalancePolicy balance = BalancePolicy::LeastOutstanding;
+    size_t upstream_idle = 2;
+    for (int i = 4; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            print_usage();
+            std::cerr << "Missing value for option " << option << std::endl;
+            return 1;
+        }
+        if (option == "--proxy") {
+            proxy_routes.push_back(argv[++i]);
+            continue;
+        } else if (option == "--balance") {
+            std::string policy = argv[++i];
+            if (policy == "least-outstanding") {
+                balance = BalancePolicy::LeastOutstanding;
+            } else if (policy == "consistent-hash") {
+                balance = BalancePolicy::ConsistentHash;
+            } else {
+                print_usage();
+                std::cerr << "--balance must be least-outstanding or consistent-hash" << std::endl;
+                return 1;
+            }
+            continue;
+        }
+        int value;
+        try {
+            value = std::stoi(argv[++i]);
+            if (value <= 0) {
+                throw std::out_of_range("");
+            }
+        } catch (const std::logic_error&) {
+            print_usage();
+            std::cerr << option << " must be a positive integer" << std::endl;
+            return 1;
+        }
+        if (option == "--backlog") {
+            backlog = value;
+        } else if (option == "--max-connections") {
+            max_connections = value;
+        } else if (option == "--workers") {
+            workers = value;
+        } else if (option == "--max-streams") {
+            max_streams = value;
+        } else if (option == "--upstream-idle") {
+            upstream_idle = value;
+        } else {
+            print_usage();
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
     std::string hostname = argv[1];
     unsigned short port;
     std::string root = argv[3];
@@ -47,6 +130,16 @@ int main(int argc, char **argv) {
     }
 
     SimpleHttpServer server(hostname, port, root);
+    ReverseProxy proxy;
+    try {
+        for (const std::string &route : proxy_routes) {
+            proxy.addRoute(route, balance, upstream_idle);
+        }
+    } catch (const std::runtime_error &e) {
+        print_usage();
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 
     // Get addresses to listen on
     std::vector<sockaddr> addresses;
@@ -85,13 +178,17 @@ int main(int argc, char **argv) {
         }
 
         // Listen on socket
-        result = listen(sock, 16);
+        result = listen(sock, backlog);
         if (result == -1) {
             std::cerr << "Error listenting on " << ip_to_string(addr) << std::endl;
             close(sock);
             continue;
         }
 
+        // Accepting must not block the loop if a connection is reset between
+        // select and accept
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
         max_listen_socket_fd = std::max(max_listen_socket_fd, sock);
         FD_SET(sock, &listen_sockets);
         std::cout << "Listening on " << ip_to_string(addr) << " on port " << port << std::endl;
@@ -101,13 +198,61 @@ int main(int argc, char **argv) {
         std::abort();
     }
 
-    // Wait for connections and handle them
-    std::vector<std::future<void>> connections;
+    // Start the worker threads which serve admitted connections
+    AdmissionController admission(max_connections);
+    std::vector<std::thread> worker_threads;
+    for (size_t i = 0; i < workers; i++) {
+        worker_threads.emplace_back([&server, &proxy, &admission, max_streams] {
+            while (true) {
+                AdmissionController::Connection connection = admission.next();
+                bool succeeded = true;
+                if (connection.shed) {
+                    shed_connection(connection.fd);
+                } else {
+                    try {
+                        handle_connection(server, proxy, connection.fd, max_streams);
+                    } catch (const std::runtime_error &e) {
+                        std::cerr << e.what() << std::endl;
+                        succeeded = false;
+                    }
+                }
+                admission.finished(connection, succeeded);
+            }
+        });
+    }
+
+    // Without SA_RESTART, so that select returns at once
+    struct sigaction stop_action = {};
+    stop_action.sa_handler = [] (int) { stop_requested = 1; };
+    sigaction(SIGINT, &stop_action, nullptr);
+    sigaction(SIGTERM, &stop_action, nullptr);
+
+    // Wait for connections and hand them to the workers
+    AdmissionController::Stats last_stats = admission.getStats();
+    auto last_stats_report = std::chrono::steady_clock::now();
     while (true) {
         timeval timer = {};
         timer.tv_sec = 0;
         timer.tv_usec = 20000;
 
+        if (stop_requested) {
+            print_admission_stats(admission.getStats());
+            _exit(0);
+        }
+
+        // Periodically report shedding while it is happening
+        if (std::chrono::steady_clock::now() - last_stats_report > std::chrono::seconds(5)) {
+            AdmissionController::Stats stats = admission.getStats();
+            if (stats.shed_overflow != last_stats.shed_overflow
+                    || stats.shed_delay != last_stats.shed_delay) {
+                print_admission_stats(stats);
+            }
+            last_stats = stats;
+            last_stats_report = std::chrono::steady_clock::now();
+        }
+
+        close_lingering();
+
         fd_set ready_sockets = listen_sockets;
         if (select(max_listen_socket_fd + 1, &ready_sockets, NULL, NULL, &timer) == 0) {
             continue;
@@ -124,63 +269,254 @@ int main(int argc, char **argv) {
                 socklen_t addr_size = sizeof(addr);
                 int client_sock = accept(i, &addr, &addr_size);
                 if (client_sock == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                        continue;
+                    }
                     std::cerr << "Error accepting connection from " << ip_to_string(addr)
                               << " on " << ip_to_string(local_addr) << std::endl;
                     continue;
                 }
 
-                // Process connection
+                // Don't let a slow client hold on to a worker indefinitely. A
+                // proxy in front of us must time out its idle connections
+                // sooner, as UpstreamPool does.
+                timeval receive_timeout = {};
+                receive_timeout.tv_sec = 5;
+                setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO,
+                           &receive_timeout, sizeof(receive_timeout));
+
+                // Queue connection, or turn it away if we are at capacity
+                if (!admission.admit(client_sock)) {
+                    shed_connection(client_sock);
+                    continue;
+                }
                 std::cout << "Accepting connection request from " << ip_to_string(addr)
                           << " on " << ip_to_string(local_addr) << std::endl;
-                connections.push_back(std::async(std::launch::async, [&server] (const int fd) {
-                        const size_t buffer_size = 256;
-                        char buffer[buffer_size];
-                        std::stringstream ss;
-
-                        do {
-                            ssize_t bytes_received = recv(fd, buffer, buffer_size, 0);
-                            if (bytes_received < 0) {
-                                throw std::runtime_error("Client disconnected unexpectedly.");
-                            } else if (bytes_received == 0) {
-                                break;
-                            } else {
-                                ss.write(buffer, bytes_received);
-                            }
-                            // Don't need to go past the header for the supported
-                            // simple requests
-                        } while (!std::strstr(buffer, "\r\n\r\n"));
-
-                        HttpResponse response;
-                        try {
-                            HttpRequest request = HttpRequest::consume(ss.str());
-                            response = server.processRequest(request);
-                        } catch (const std::runtime_error &e) {
-                            response = HttpResponse("400", "HTTP/1.0");
-                        }
-                        std::string response_str = response.encode();
-                        send(fd, response_str.data(), response_str.size(), 0);
-
-                        close(fd);
-                    }, client_sock));
             }
         }
+    }
+}
+
+// Whether the client asked to keep the connection open after this request.
+// Requests with a body are not kept alive, since we don't read bodies.
+bool wants_keep_alive(const HttpRequest &request) {
+    if (request.hasHeader("Content-Length") || request.hasHeader("Transfer-Encoding")) {
+        return false;
+    }
+    std::string connection = request.getHeader("Connection");
+    std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+    if (request.getVersion() == "HTTP/1.1") {
+        return connection.find("close") == std::string::npos;
+    }
+    return connection.find("keep-alive") != std::string::npos;
+}
+
+// Whether request asks to upgrade to h2c (RFC 7540 section 3.2). Only
+// HTTP/1.1 requests without a body qualify, and Connection must name both
+// Upgrade and HTTP2-Settings, so that neither was added by an intermediary
+// that does not understand them.
+bool wants_h2c_upgrade(const HttpRequest &request) {
+    std::string connection = request.getHeader("Connection");
+    return request.getVersion() == "HTTP/1.1"
+        && http_has_token(request.getHeader("Upgrade"), "h2c")
+        && request.hasHeader("HTTP2-Settings")
+        && http_has_token(connection, "Upgrade") && http_has_token(connection, "HTTP2-Settings")
+        && !request.hasHeader("Content-Length")
+        && !request.hasHeader("Transfer-Encoding");
+}
+
+// Sends response, streaming its body if it has a body reader. Streamed bodies
+// without a Content-Length are sent chunked if chunked_allowed, or else ended
+// by closing the connection. Returns whether the connection can be kept open
+// for another request, which needs keep_alive.
+bool send_response(int fd, HttpResponse &response, bool chunked_allowed, bool keep_alive) {
+    // Requests that allow chunked coding are HTTP/1.1, and are answered as
+    // such whatever the framing, so one connection never mixes versions
+    if (chunked_allowed && response.getVersion() != "HTTP/1.1") {
+        if (!response.getPreSerialized().empty()) {
+            response = HttpResponse::error(response.getStatusCode(), "HTTP/1.1");
+        } else {
+            response.setVersion("HTTP/1.1");
+        }
+    }
+    StaticBytes pre_serialized = response.getPreSerialized();
+    if (!pre_serialized.empty()) {
+        http_send_all(fd, pre_serialized.data, pre_serialized.size);
+        return false;
+    }
+
+    bool unknown_length = response.hasBodyReader() && !response.hasHeader("Content-Length");
+    bool chunked = unknown_length && chunked_allowed;
+    keep_alive = keep_alive && (!unknown_length || chunked);
+    if (chunked) {
+        response.addHeader("Transfer-Encoding", "chunked");
+    }
+    response.addHeader("Connection", keep_alive ? "keep-alive" : "close");
+    if (!response.hasBodyReader()) {
+        std::string response_str = response.encode();
+        return http_send_all(fd, response_str.data(), response_str.size()) && keep_alive;
+    }
+
+    // Send each piece of the body as soon as it has been read
+    std::string head = response.encodeHead();
+    if (!http_send_all(fd, head.data(), head.size())) {
+        return false;
+    }
+    // A body with a Content-Length must be exactly that long, even if the
+    // file changes while it is being sent
+    unsigned long long remaining =
+        unknown_length ? 0 : std::stoull(response.getHeader("Content-Length"));
+    const HttpResponse::BodyReader &reader = response.getBodyReader();
+    char buffer[16 * 1024];
+    ssize_t bytes_read = 0;
+    while (unknown_length || remaining > 0) {
+        size_t wanted = unknown_length
+            ? sizeof(buffer) : std::min<unsigned long long>(sizeof(buffer), remaining);
+        bytes_read = reader(buffer, wanted);
+        if (bytes_read <= 0) {
+            break;
+        }
+        if (!unknown_length) {
+            remaining -= bytes_read;
+        }
+        bool sent;
+        if (chunked) {
+            std::string chunk = chunked_encode(buffer, bytes_read);
+            sent = http_send_all(fd, chunk.data(), chunk.size());
+        } else {
+            sent = http_send_all(fd, buffer, bytes_read);
+        }
+        if (!sent) {
+            return false;
+        }
+    }
+    // Without the last chunk, or with a short body, the client can tell that
+    // the body was cut off by a read error
+    if (bytes_read < 0 || remaining > 0) {
+        return false;
+    }
+    if (chunked) {
+        std::string end = chunked_encode_end();
+        return http_send_all(fd, end.data(), end.size()) && keep_alive;
+    }
+    return keep_alive;
+}
 
-        // Check for threads that have finished execution
-        for (auto it = connections.begin(); it != connections.end(); it++) {
-            auto &f = *it;
+void handle_connection(const SimpleHttpServer &server, ReverseProxy &proxy, int fd,
+                       size_t max_streams) {
+    std::string received;
+    for (size_t requests = 0; ; requests++) {
+        // A connection closing or timing out before sending anything is not
+        // an error. A request cut off part way is answered with 400 below.
+        size_t header_length = http_receive_header(fd, received);
+        if (header_length == std::string::npos && received.empty()) {
+            break;
+        }
 
-            if (!f.valid()) {
-                continue;
+        // HTTP/2 with prior knowledge. The preface starts with what looks like
+        // an HTTP/1 request line and a blank line.
+        if (requests == 0 && received.compare(0, 14, http2_preface, 0, 14) == 0) {
+            try {
+                Http2ServerConnection(server, fd, max_streams).run(received);
+            } catch (const std::runtime_error&) {
+                close(fd);
+                throw;
             }
-            auto status = f.wait_for(std::chrono::seconds(0));
-            if (status == std::future_status::ready) {
-                try {
-                    f.get(); // May throw an exception
-                    it = connections.erase(it);
-                } catch (const std::runtime_error &e) {
-                    std::cerr << e.what() << std::endl;
+            break;
+        }
+
+        HttpRequest request;
+        HttpResponse response;
+        bool upgrade = false;
+        bool keep_alive = false;
+        bool chunked_allowed = false;
+        try {
+            request = HttpRequest::consume(received);
+            // Upgrades are served below, since errors after the 101 must not
+            // be answered in HTTP/1
+            upgrade = wants_h2c_upgrade(request);
+            if (!upgrade) {
+                if (proxy.route(request.getPath()) != nullptr) {
+                    proxy.forward(fd, request, received.substr(header_length));
+                    break;
                 }
+                response = server.processRequest(request);
+                keep_alive = wants_keep_alive(request);
+                chunked_allowed = request.getVersion() == "HTTP/1.1";
             }
+        } catch (const std::runtime_error &e) {
+            response = HttpResponse::error(HttpStatus::BadRequest);
+        }
+        if (upgrade) {
+            // Http2ServerConnection answers its own protocol errors with GOAWAY
+            try {
+                Http2ServerConnection(server, fd, max_streams)
+                    .runUpgrade(request, received.substr(header_length));
+            } catch (const std::runtime_error&) {
+                close(fd);
+                throw;
+            }
+            break;
+        }
+        if (!send_response(fd, response, chunked_allowed, keep_alive)) {
+            break;
+        }
+        received.erase(0, header_length);
+    }
+
+    close(fd);
+}
+
+// Shed connections that are waiting for the client to close, with the time
+// they are closed regardless. Closing a socket with an unread request in it
+// sends an RST, which can make the client throw away the 503 before reading
+// it, so requests are drained until the client closes or a second passes.
+// The fd limit is shared with served connections, so few are kept.
+std::mutex lingering_mutex;
+std::deque<std::pair<int, std::chrono::steady_clock::time_point>> lingering;
+const size_t max_lingering = 256;
+
+// Discards whatever has arrived on fd, without blocking. Returns false once
+// the client has closed its side or the connection has failed.
+bool drain(int fd) {
+    char buffer[4096];
+    while (true) {
+        ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (bytes_received <= 0) {
+            return bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+}
+
+// Rejects a connection without reading the request, using a response that is
+// serialized at compile time so that shedding stays cheap under overload.
+void shed_connection(int fd) {
+    StaticBytes response = http_status_info(HttpStatus::ServiceUnavailable)->error_response;
+    send(fd, response.data, response.size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(fd, SHUT_WR);
+    if (!drain(fd)) {
+        close(fd);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(lingering_mutex);
+    if (lingering.size() >= max_lingering) {
+        close(fd);
+        return;
+    }
+    lingering.push_back(std::make_pair(fd, std::chrono::steady_clock::now()
+                                           + std::chrono::seconds(1)));
+}
+
+// Closes the shed connections that are done, from the accept loop
+void close_lingering() {
+    std::lock_guard<std::mutex> lock(lingering_mutex);
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = lingering.begin(); it != lingering.end(); ) {
+        if (now >= it->second || !drain(it->first)) {
+            close(it->first);
+            it = lingering.erase(it);
+        } else {
+            ++it;
         }
     }
 }
@@ -225,6 +561,18 @@ std::string ip_to_string(const sockaddr &address) {
     return str;
 }
 
+void print_admission_stats(const AdmissionController::Stats &stats) {
+    std::cout << "Admission: " << stats.admitted << " admitted, "
+              << stats.served << " served, "
+              << stats.failed << " failed, "
+              << stats.shed_overflow << " shed (connection limit), "
+              << stats.shed_delay << " shed (queue delay)" << std::endl;
+}
+
 void print_usage() {
-    std::cerr << "Usage: web-server hostname port root" << std::endl;
+    std::cerr << "Usage: web-server hostname port root"
+              << " [--backlog n] [--max-connections n] [--workers n] [--max-streams n]"
+              << " [--proxy /prefix=host:port,...] [--balance least-outstanding|consistent-hash]"
+              << " [--upstream-idle n]"
+              << std::endl;
 }